@@ -0,0 +1,152 @@
+template <class Object, int Dim, class Coord>
+KDForest<Object,Dim,Coord>::KDForest(size_t c,size_t b) : bufferOldest(0), bufferNewest(0), capacity(c), bucket(b), window(0), latest(0)
+{
+	if (capacity<1) capacity=1;
+	buffer.reserve(capacity);
+}
+
+template <class Object, int Dim, class Coord>
+void KDForest<Object,Dim,Coord>::clear(void)
+{
+	for (size_t i=0;i<components.size();i++) delete components[i].tree;
+	components.clear();
+	buffer.clear();
+}
+
+template <class Object, int Dim, class Coord>
+void KDForest<Object,Dim,Coord>::insert(const KDObj& data,long stamp)
+{
+	if (buffer.empty() || stamp<bufferOldest) bufferOldest=stamp;
+	if (buffer.empty() || stamp>bufferNewest) bufferNewest=stamp;
+	if (stamp>latest) latest=stamp;
+	buffer.push_back(data);
+	if (buffer.size()>=capacity) merge();
+}
+
+//La premiere composante vide j recoit le tampon et les composantes 0 a j-1 :
+//buffer+buffer+2*buffer+...+2^(j-1)*buffer=2^j*buffer points au plus
+template <class Object, int Dim, class Coord>
+void KDForest<Object,Dim,Coord>::merge(void)
+{
+	size_t j=0;
+	while (j<components.size() && components[j].tree!=NULL) j++;
+	if (j==components.size())
+	{
+		Component empty;
+		empty.tree=NULL;
+		empty.oldest=empty.newest=0;
+		components.push_back(empty);
+	}
+	
+	//Les points des composantes sont relus dans leurs arbres
+	vector<KDObj> data;
+	data.reserve(capacity<<j);
+	for (size_t k=0;k<buffer.size();k++) data.push_back(buffer[k]);
+	long oldest=bufferOldest,newest=bufferNewest;
+	buffer.clear();
+	for (size_t i=0;i<j;i++)
+	{
+		const Frozen& tree=*components[i].tree;
+		for (size_t k=0;k<static_cast<size_t>(tree.count());k++)
+		{
+			Coord c[Dim];
+			for (short d=0;d<Dim;d++) c[d]=tree.coord(k,d);
+			data.push_back(KDObj(tree.object(k),c));
+		}
+		oldest=min(oldest,components[i].oldest);
+		newest=max(newest,components[i].newest);
+		delete components[i].tree;
+		components[i].tree=NULL;
+	}
+	components[j].tree=new Frozen(data.begin(),data.end(),bucket);
+	components[j].oldest=oldest;
+	components[j].newest=newest;
+	
+	if (window>0) expire(latest-window);
+}
+
+template <class Object, int Dim, class Coord>
+long KDForest<Object,Dim,Coord>::expire(long before)
+{
+	long dropped=0;
+	if (!buffer.empty() && bufferNewest<before)
+	{
+		dropped+=buffer.size();
+		buffer.clear();
+	}
+	for (size_t i=0;i<components.size();i++)
+		if (components[i].tree!=NULL && components[i].newest<before)
+		{
+			dropped+=components[i].tree->count();
+			delete components[i].tree;
+			components[i].tree=NULL;
+		}
+	//Les composantes vides en fin de liste ne servent plus
+	while (!components.empty() && components.back().tree==NULL) components.pop_back();
+	return dropped;
+}
+
+template <class Object, int Dim, class Coord>
+typename KDForest<Object,Dim,Coord>::KDRes KDForest<Object,Dim,Coord>::findNN(const Coord* point) const
+{
+	KDRes best;
+	for (size_t k=0;k<buffer.size();k++)
+	{
+		Dist d=buffer[k].dist(point);
+		if (best.dist<0 || d<best.dist) best=KDRes(buffer[k],d);
+	}
+	for (size_t i=0;i<components.size();i++)
+		if (components[i].tree!=NULL)
+		{
+			KDRes res=components[i].tree->findNN(point);
+			if (res.dist>=0 && (best.dist<0 || res.dist<best.dist)) best=res;
+		}
+	return best;
+}
+
+template <class Object, int Dim, class Coord>
+vector<typename KDForest<Object,Dim,Coord>::KDRes> KDForest<Object,Dim,Coord>::findNear(const Coord* point,const Dist radius) const
+{
+	vector<KDRes> neighbor;
+	const Dist sqradius=radius*radius;
+	for (size_t k=0;k<buffer.size();k++)
+	{
+		Dist d=buffer[k].sqdist(point);
+		if (d<=sqradius) neighbor.push_back(KDRes(buffer[k],sqrt(d)));
+	}
+	for (size_t i=0;i<components.size();i++)
+		if (components[i].tree!=NULL)
+		{
+			vector<KDRes> res=components[i].tree->findNear(point,radius);
+			neighbor.insert(neighbor.end(),res.begin(),res.end());
+		}
+	return neighbor;
+}
+
+template <class Object, int Dim, class Coord>
+long KDForest<Object,Dim,Coord>::count(void) const
+{
+	long nb=buffer.size();
+	for (size_t i=0;i<components.size();i++)
+		if (components[i].tree!=NULL) nb+=components[i].tree->count();
+	return nb;
+}
+
+template <class Object, int Dim, class Coord>
+size_t KDForest<Object,Dim,Coord>::trees(void) const
+{
+	size_t nb=0;
+	for (size_t i=0;i<components.size();i++)
+		if (components[i].tree!=NULL) nb++;
+	return nb;
+}
+
+template <class Object, int Dim, class Coord>
+void KDForest<Object,Dim,Coord>::stats(void) const
+{
+	cout << "NbNodes Stored : " << count() << endl;
+	cout << "Buffer : " << buffer.size() << " / " << capacity << " points" << endl;
+	for (size_t i=0;i<components.size();i++)
+		if (components[i].tree!=NULL)
+			cout << "Tree " << i << " : " << components[i].tree->count() << " points, dated " << components[i].oldest << " to " << components[i].newest << endl;
+}
@@ -0,0 +1,76 @@
+#ifndef KDFOREST_HH
+#define KDFOREST_HH 1
+
+#include "KDFrozenTree.hh"
+
+//Index dynamique fait d'arbres statiques (methode logarithmique de Bentley et Saxe)
+//Les insertions vont dans un petit tampon non trie. Quand il est plein, il est fusionne avec
+//les composantes 0 a j-1 (toutes pleines) en une composante j, reconstruite d'un coup :
+//la composante i contient au plus buffer*2^i points, chacun est donc reconstruit
+//O(log n) fois au total, et chaque composante est un arbre fige parfaitement equilibre.
+//Les requetes interrogent le tampon et toutes les composantes (au plus log2(n/buffer)+1).
+//Une composante ne contient que des points arrives a la suite : plus elle est grande, plus
+//ils sont anciens. On peut donc oublier d'un coup les composantes dont tous les points sont
+//trop anciens, pour une fenetre glissante (expire, setWindow).
+template <class Object, int Dim=DIMENSIONS, class Coord=float> class KDForest
+{
+	public:
+	typedef KDTree<Object,Dim,Coord> Tree;
+	typedef KDFrozenTree<Object,Dim,Coord> Frozen;
+	typedef typename Tree::KDObj KDObj;
+	typedef typename Tree::KDRes KDRes;
+	typedef typename Tree::Dist Dist;
+	
+	private:
+	//Arbre d'une composante (NULL si elle est vide), et dates de ses points
+	struct Component
+	{
+		Frozen* tree;
+		long oldest,newest;
+	};
+	
+	vector<KDObj> buffer;
+	long bufferOldest,bufferNewest;
+	size_t capacity;
+	size_t bucket;
+	vector<Component> components;
+	//Fenetre glissante (0 : aucune), et date la plus recente inseree
+	long window;
+	long latest;
+	
+	//Non copiable
+	KDForest(const KDForest&);
+	KDForest& operator = (const KDForest&);
+	
+	//Fusionne le tampon plein avec les premieres composantes
+	void merge(void);
+	
+	public:
+	
+	//capacity : taille du tampon (et de la plus petite composante)
+	//bucket : taille des feuilles des composantes
+	KDForest(size_t capacity=1024,size_t bucket=16);
+	~KDForest() {clear();}
+	
+	//Insertion en O(log n) amorti. stamp : date du point (en unites quelconques, croissante)
+	void insert(const KDObj& data,long stamp=0);
+	//Oublie les composantes (tampon compris) dont tous les points sont dates d'avant before,
+	//renvoie le nombre de points oublies. Les points plus recents sont toujours gardes.
+	long expire(long before);
+	//Fenetre glissante : a chaque fusion, expire(derniere date - window) ; 0 pour la desactiver
+	void setWindow(long w) {window=w;}
+	void clear(void);
+	
+	//Requetes, equivalentes a celles du KDTree
+	KDRes findNN(const Coord* point) const;
+	vector<KDRes> findNear(const Coord* point,const Dist radius) const;
+	long count(void) const;
+	//Nombre d'arbres non vides
+	size_t trees(void) const;
+	void stats(void) const;
+};
+
+//Because of the template class, implementation must be here :(
+#include "KDForest.cc"
+
+#endif /* !KDFOREST_HH */
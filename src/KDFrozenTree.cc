@@ -0,0 +1,1007 @@
+template <class Object, int Dim, class Coord>
+KDFrozenTree<Object,Dim,Coord>::KDFrozenTree(const Tree& tree,size_t b) : n(0), bucket(b), mapping(NULL), mapsize(0)
+{
+	if (bucket<1) bucket=1;
+	if (bucket>maxbucket) bucket=maxbucket;
+	
+	//On recupere les objets du KDTree (sauf les supprimes) avec une pile explicite, sans le modifier
+	vector<const KDObj*> data;
+	vector<const typename Tree::KDNode*> todo;
+	if (tree.root!=NULL) todo.push_back(tree.root);
+	while(!todo.empty())
+	{
+		const typename Tree::KDNode* temp=todo.back();todo.pop_back();
+		if (!temp->removed) data.push_back(&temp->data());
+		if (temp->left!=NULL) todo.push_back(temp->left);
+		if (temp->right!=NULL) todo.push_back(temp->right);
+	}
+	build(data);
+}
+
+template <class Object, int Dim, class Coord>
+template <class Iterator>
+KDFrozenTree<Object,Dim,Coord>::KDFrozenTree(Iterator first,Iterator last,size_t b) : n(0), bucket(b), mapping(NULL), mapsize(0)
+{
+	if (bucket<1) bucket=1;
+	if (bucket>maxbucket) bucket=maxbucket;
+	
+	vector<const KDObj*> data;
+	for (;first!=last;++first) data.push_back(&*first);
+	build(data);
+}
+
+//Chaque noeud coupe son intervalle en deux moities egales, selon la dimension la plus etendue
+//Le nombre de feuilles est une puissance de 2 : l'arbre est complet, les feuilles ont
+//toutes la meme taille a un point pres
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::build(vector<const KDObj*>& data)
+{
+	n=data.size();
+	nbleaves=1;
+	while (nbleaves*bucket<n) nbleaves*=2;
+	axisData.assign(nbleaves-1,0);
+	splitsData.assign(nbleaves-1,Coord());
+	leavesData.assign(nbleaves+1,n);
+	split(data,0,0);
+	
+	//Les points sont recopies dans l'ordre des feuilles
+	coordsData.assign(dimensions*n,Coord());
+	objectsData.assign(n,Object::ERROR);
+	for (size_t k=0;k<n;k++)
+	{
+		for (short d=0;d<dimensions;d++) coordsData[d*n+k]=(*data[k])[d];
+		objectsData[k]=data[k]->obj;
+	}
+	view();
+}
+
+//Construit le sous arbre du noeud root avec les points de data, qui occupent les positions
+//offset a offset+data.size() de l'arbre ; data est reordonne dans l'ordre des feuilles
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::split(vector<const KDObj*>& data,size_t root,size_t offset)
+{
+	//Pile des intervalles restant a couper : noeud, debut, fin
+	vector<size_t> todo;
+	todo.push_back(root);todo.push_back(0);todo.push_back(data.size());
+	while(!todo.empty())
+	{
+		size_t last=todo.back();todo.pop_back();
+		size_t first=todo.back();todo.pop_back();
+		size_t node=todo.back();todo.pop_back();
+		
+		if (isLeaf(node))
+		{
+			leavesData[node-(nbleaves-1)]=offset+first;
+			continue;
+		}
+		size_t mid=first+(last-first)/2;
+		if (last>first)
+		{
+			//Dimension de coupe : la plus etendue sur l'intervalle
+			Coord min[Dim];
+			Coord max[Dim];
+			KDUnroll<Dim>::copy(min,data[first]->coords);
+			KDUnroll<Dim>::copy(max,data[first]->coords);
+			for (size_t k=first+1;k<last;k++) KDUnroll<Dim>::minmax(data[k]->coords,min,max);
+			short dim=0;
+			for (short d=1;d<dimensions;d++)
+				if (max[d]-min[d]>max[dim]-min[dim]) dim=d;
+			
+			nth_element(data.begin()+first,data.begin()+mid,data.begin()+last,KDObjCompare(dim));
+			axisData[node]=static_cast<unsigned char>(dim);
+			splitsData[node]=(*data[mid])[dim];
+		}
+		todo.push_back(2*node+1);todo.push_back(first);todo.push_back(mid);
+		todo.push_back(2*node+2);todo.push_back(mid);todo.push_back(last);
+	}
+}
+
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::view(void)
+{
+	coords=coordsData.empty() ? NULL : &coordsData[0];
+	objects=objectsData.empty() ? NULL : &objectsData[0];
+	axis=axisData.empty() ? NULL : &axisData[0];
+	splits=splitsData.empty() ? NULL : &splitsData[0];
+	leaves=&leavesData[0];
+	qview();
+}
+
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::qview(void)
+{
+	qcoords=qcoordsData.empty() ? NULL : &qcoordsData[0];
+	qlo=qloData.empty() ? NULL : &qloData[0];
+	qstep=qstepData.empty() ? NULL : &qstepData[0];
+}
+
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::copy(const KDFrozenTree& tree)
+{
+	n=tree.n;
+	bucket=tree.bucket;
+	nbleaves=tree.nbleaves;
+	coordsData.assign(tree.coords,tree.coords+dimensions*n);
+	objectsData.assign(tree.objects,tree.objects+n);
+	axisData.assign(tree.axis,tree.axis+nbleaves-1);
+	splitsData.assign(tree.splits,tree.splits+nbleaves-1);
+	leavesData.assign(tree.leaves,tree.leaves+nbleaves+1);
+	if (tree.quantized())
+	{
+		qcoordsData.assign(tree.qcoords,tree.qcoords+dimensions*n);
+		qloData.assign(tree.qlo,tree.qlo+nbleaves*Dim);
+		qstepData.assign(tree.qstep,tree.qstep+nbleaves*Dim);
+	}
+	else
+	{
+		qcoordsData.clear();
+		qloData.clear();
+		qstepData.clear();
+	}
+	view();
+}
+
+template <class Object, int Dim, class Coord>
+KDFrozenTree<Object,Dim,Coord>& KDFrozenTree<Object,Dim,Coord>::operator = (const KDFrozenTree& tree)
+{
+	if (this!=&tree)
+	{
+		//On copie avant de liberer : tree peut pointer dans nos propres tableaux
+		KDFrozenTree temp(tree);
+		unmap();
+		copy(temp);
+	}
+	return *this;
+}
+
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::unmap(void)
+{
+#ifndef __MINGW32__
+	if (mapping!=NULL) munmap(mapping,mapsize);
+#endif
+	mapping=NULL;
+	mapsize=0;
+	vector<char>().swap(image);
+}
+
+//Entete decrivant l'arbre et la position de ses tableaux
+template <class Object, int Dim, class Coord>
+typename KDFrozenTree<Object,Dim,Coord>::KDFileHeader KDFrozenTree<Object,Dim,Coord>::header(void) const
+{
+	KDFileHeader h;
+	memset(&h,0,sizeof(h));
+	memcpy(h.magic,"KDFROZEN",8);
+	h.version=fileversion;
+	h.endian=0x01020304;
+	h.dim=Dim;
+	h.coordkind=coordKind();
+	h.coordsize=sizeof(Coord);
+	h.objectsize=sizeof(Object);
+	h.sizesize=sizeof(size_t);
+	h.n=n;
+	h.bucket=bucket;
+	h.nbleaves=nbleaves;
+	layout(h,quantized());
+	return h;
+}
+
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::layout(KDFileHeader& h,bool quant)
+{
+	h.coords=align(sizeof(KDFileHeader));
+	h.objects=align(h.coords+dimensions*h.n*sizeof(Coord));
+	h.axis=align(h.objects+h.n*sizeof(Object));
+	h.splits=align(h.axis+h.nbleaves-1);
+	h.leaves=align(h.splits+(h.nbleaves-1)*sizeof(Coord));
+	h.size=h.leaves+(h.nbleaves+1)*sizeof(size_t);
+	h.qcoords=h.qlo=h.qstep=0;
+	if (quant)
+	{
+		h.qcoords=align(h.size);
+		h.qlo=align(h.qcoords+dimensions*h.n*sizeof(unsigned short));
+		h.qstep=align(h.qlo+h.nbleaves*Dim*sizeof(Coord));
+		h.size=h.qstep+h.nbleaves*Dim*sizeof(Dist);
+	}
+}
+
+template <class Object, int Dim, class Coord>
+bool KDFrozenTree<Object,Dim,Coord>::save(const char* path) const
+{
+	ofstream out(path,ios::out | ios::binary | ios::trunc);
+	if (!out) return false;
+	const KDFileHeader h=header();
+	//Chaque tableau est ecrit a sa position, precedee de zeros d'alignement
+	//Les coordonnees quantifiees ne sont ecrites que si l'arbre l'est
+	const char* parts[8]={reinterpret_cast<const char*>(coords),reinterpret_cast<const char*>(objects),
+		reinterpret_cast<const char*>(axis),reinterpret_cast<const char*>(splits),reinterpret_cast<const char*>(leaves),
+		reinterpret_cast<const char*>(qcoords),reinterpret_cast<const char*>(qlo),reinterpret_cast<const char*>(qstep)};
+	const size_t starts[8]={h.coords,h.objects,h.axis,h.splits,h.leaves,h.qcoords,h.qlo,h.qstep};
+	const size_t sizes[8]={dimensions*n*sizeof(Coord),n*sizeof(Object),nbleaves-1,(nbleaves-1)*sizeof(Coord),(nbleaves+1)*sizeof(size_t),
+		dimensions*n*sizeof(unsigned short),nbleaves*Dim*sizeof(Coord),nbleaves*Dim*sizeof(Dist)};
+	const int nbparts=quantized() ? 8 : 5;
+	const char zeros[64]={0};
+	out.write(reinterpret_cast<const char*>(&h),sizeof(h));
+	size_t pos=sizeof(h);
+	for (int i=0;i<nbparts;i++)
+	{
+		out.write(zeros,starts[i]-pos);
+		if (sizes[i]>0) out.write(parts[i],sizes[i]);
+		pos=starts[i]+sizes[i];
+	}
+	out.close();
+	return !out.fail();
+}
+
+template <class Object, int Dim, class Coord>
+bool KDFrozenTree<Object,Dim,Coord>::mapFile(const char* path)
+{
+	char* base=NULL;
+	size_t size=0;
+#ifndef __MINGW32__
+	int fd=open(path,O_RDONLY);
+	if (fd<0) return false;
+	struct stat st;
+	if (fstat(fd,&st)!=0 || static_cast<size_t>(st.st_size)<sizeof(KDFileHeader))
+	{
+		close(fd);
+		return false;
+	}
+	size=st.st_size;
+	void* area=mmap(NULL,size,PROT_READ,MAP_SHARED,fd,0);
+	//La projection reste valide apres la fermeture du fichier
+	close(fd);
+	if (area==MAP_FAILED) return false;
+	base=static_cast<char*>(area);
+#else
+	vector<char> file;
+	ifstream in(path,ios::in | ios::binary);
+	if (!in) return false;
+	in.seekg(0,ios::end);
+	size=in.tellg();
+	in.seekg(0,ios::beg);
+	if (size<sizeof(KDFileHeader)) return false;
+	file.resize(size);
+	in.read(&file[0],size);
+	if (in.fail()) return false;
+	base=&file[0];
+#endif
+	
+	//L'entete doit decrire exactement un arbre de ce type, sur cette architecture
+	KDFileHeader h;
+	memcpy(&h,base,sizeof(h));
+	KDFrozenTree empty;
+	KDFileHeader expected=empty.header();
+	bool valid=(memcmp(h.magic,expected.magic,8)==0 && h.version==expected.version && h.endian==expected.endian
+		&& h.dim==expected.dim && h.coordkind==expected.coordkind && h.coordsize==expected.coordsize
+		&& h.objectsize==expected.objectsize && h.sizesize==expected.sizesize && h.bucket>=1 && h.bucket<=maxbucket && h.nbleaves>=1);
+	if (valid)
+	{
+		//Les positions se deduisent des tailles : on les recalcule pour ne jamais lire hors du fichier
+		expected.n=h.n;
+		expected.nbleaves=h.nbleaves;
+		layout(expected,h.qcoords!=0);
+		valid=(h.coords==expected.coords && h.objects==expected.objects && h.axis==expected.axis && h.splits==expected.splits
+			&& h.leaves==expected.leaves && h.qcoords==expected.qcoords && h.qlo==expected.qlo && h.qstep==expected.qstep
+			&& h.size==expected.size && h.size<=size);
+	}
+	if (valid)
+	{
+		//Les noeuds ne doivent pas mener hors des tableaux (quelques Ko a lire)
+		const unsigned char* a=reinterpret_cast<const unsigned char*>(base+h.axis);
+		const size_t* l=reinterpret_cast<const size_t*>(base+h.leaves);
+		for (size_t i=0;i+1<h.nbleaves && valid;i++) valid=(a[i]<Dim);
+		for (size_t i=0;i<h.nbleaves && valid;i++) valid=(l[i]<=l[i+1] && l[i+1]-l[i]<=h.bucket);
+		valid=valid && l[0]==0 && l[h.nbleaves]==h.n;
+	}
+	if (!valid)
+	{
+#ifndef __MINGW32__
+		munmap(base,size);
+#endif
+		return false;
+	}
+	
+	//Les tableaux sont utilises en place
+	unmap();
+	coordsData.clear();
+	qcoordsData.clear();
+	qloData.clear();
+	qstepData.clear();
+	objectsData.clear();
+	axisData.clear();
+	splitsData.clear();
+	leavesData.clear();
+#ifndef __MINGW32__
+	mapping=base;
+	mapsize=size;
+#else
+	image.swap(file);
+	base=&image[0];
+#endif
+	n=h.n;
+	bucket=h.bucket;
+	nbleaves=h.nbleaves;
+	coords=reinterpret_cast<const Coord*>(base+h.coords);
+	objects=reinterpret_cast<const Object*>(base+h.objects);
+	axis=reinterpret_cast<const unsigned char*>(base+h.axis);
+	splits=reinterpret_cast<const Coord*>(base+h.splits);
+	leaves=reinterpret_cast<const size_t*>(base+h.leaves);
+	qcoords=(h.qcoords==0) ? NULL : reinterpret_cast<const unsigned short*>(base+h.qcoords);
+	qlo=(h.qlo==0) ? NULL : reinterpret_cast<const Coord*>(base+h.qlo);
+	qstep=(h.qstep==0) ? NULL : reinterpret_cast<const Dist*>(base+h.qstep);
+	return true;
+}
+
+//Les parties trop grandes sont coupees exactement comme build couperait leur intervalle : meme
+//dimension, meme rang de coupe, les egalites etant reparties entre les deux moities.
+//Le rang est trouve par histogrammes successifs sur l'intervalle de valeurs qui le contient,
+//jusqu'a ce que les valeurs restantes tiennent en memoire.
+template <class Object, int Dim, class Coord>
+bool KDFrozenTree<Object,Dim,Coord>::splitFile(const KDFilePart& part,size_t maxrecords,KDFilePart& left,KDFilePart& right)
+{
+	const size_t recsize=KDRecordReader::recsize;
+	const size_t count=part.last-part.first;
+	const size_t rank=count/2;
+	const char* rec;
+	
+	//Dimension de coupe : la plus etendue sur la partie
+	Coord min[Dim];
+	Coord max[Dim];
+	{
+		KDRecordReader in(part.path.c_str());
+		size_t k=0;
+		while ((rec=in.next())!=NULL)
+		{
+			for (short d=0;d<dimensions;d++)
+			{
+				const Coord c=KDRecordReader::coord(rec,d);
+				if (k==0 || c<min[d]) min[d]=c;
+				if (k==0 || c>max[d]) max[d]=c;
+			}
+			k++;
+		}
+		if (k!=count) return false;
+	}
+	short dim=0;
+	for (short d=1;d<dimensions;d++)
+		if (max[d]-min[d]>max[dim]-min[dim]) dim=d;
+	
+	//Valeur de rang rank selon dim : below valeurs sont sous lo, celle cherchee est dans [lo,hi]
+	Coord lo=min[dim];
+	Coord hi=max[dim];
+	size_t below=0;
+	Coord value=lo;
+	size_t less=0;
+	while (true)
+	{
+		vector<size_t> bins(histbins,0);
+		vector<Coord> binmin(histbins,hi);
+		vector<Coord> binmax(histbins,lo);
+		const double scale=(lo<hi) ? histbins/(static_cast<double>(hi)-static_cast<double>(lo)) : 0.0;
+		KDRecordReader in(part.path.c_str());
+		while ((rec=in.next())!=NULL)
+		{
+			const Coord c=KDRecordReader::coord(rec,dim);
+			if (c<lo || c>hi) continue;
+			size_t b=static_cast<size_t>((static_cast<double>(c)-static_cast<double>(lo))*scale);
+			if (b>=histbins) b=histbins-1;
+			bins[b]++;
+			if (c<binmin[b]) binmin[b]=c;
+			if (c>binmax[b]) binmax[b]=c;
+		}
+		size_t b=0;
+		while (below+bins[b]<=rank) below+=bins[b++];
+		lo=binmin[b];
+		hi=binmax[b];
+		if (lo==hi)
+		{
+			value=lo;
+			less=below;
+			break;
+		}
+		if (bins[b]<=maxrecords)
+		{
+			//Les valeurs restantes tiennent en memoire
+			vector<Coord> keys;
+			keys.reserve(bins[b]);
+			KDRecordReader again(part.path.c_str());
+			while ((rec=again.next())!=NULL)
+			{
+				const Coord c=KDRecordReader::coord(rec,dim);
+				if (c>=lo && c<=hi) keys.push_back(c);
+			}
+			nth_element(keys.begin(),keys.begin()+(rank-below),keys.end());
+			value=keys[rank-below];
+			less=below;
+			for (size_t k=0;k<keys.size();k++)
+				if (keys[k]<value) less++;
+			break;
+		}
+	}
+	
+	//Repartition : les valeurs egales a la coupe completent la moitie basse
+	size_t equal=rank-less;
+	{
+		KDRecordReader in(part.path.c_str());
+		ofstream low(left.path.c_str(),ios::out | ios::binary | ios::trunc);
+		ofstream high(right.path.c_str(),ios::out | ios::binary | ios::trunc);
+		while ((rec=in.next())!=NULL)
+		{
+			const Coord c=KDRecordReader::coord(rec,dim);
+			if (c<value || (!(value<c) && equal>0))
+			{
+				if (!(c<value)) equal--;
+				low.write(rec,recsize);
+			}
+			else high.write(rec,recsize);
+		}
+		low.close();
+		high.close();
+		if (low.fail() || high.fail()) return false;
+	}
+	axisData[part.node]=static_cast<unsigned char>(dim);
+	splitsData[part.node]=value;
+	left.node=2*part.node+1;
+	left.first=part.first;
+	left.last=part.first+rank;
+	right.node=2*part.node+2;
+	right.first=part.first+rank;
+	right.last=part.last;
+	return true;
+}
+
+template <class Object, int Dim, class Coord>
+bool KDFrozenTree<Object,Dim,Coord>::buildFile(const char* points,const char* path,size_t budget,size_t bucket)
+{
+	const size_t recsize=KDRecordReader::recsize;
+	ifstream input(points,ios::in | ios::binary);
+	if (!input) return false;
+	input.seekg(0,ios::end);
+	const size_t size=input.tellg();
+	input.close();
+	if (size%recsize!=0) return false;
+	
+	//Arbre sans points : seuls ses noeuds seront remplis
+	KDFrozenTree t;
+	t.n=size/recsize;
+	t.bucket=(bucket<1) ? 1 : ((bucket>maxbucket) ? maxbucket : bucket);
+	t.nbleaves=1;
+	while (t.nbleaves*t.bucket<t.n) t.nbleaves*=2;
+	t.axisData.assign(t.nbleaves-1,0);
+	t.splitsData.assign(t.nbleaves-1,Coord());
+	t.leavesData.assign(t.nbleaves+1,t.n);
+	const KDFileHeader h=t.header();
+	
+	//Le fichier de l'arbre est cree a sa taille finale, puis rempli par morceaux
+	fstream out(path,ios::in | ios::out | ios::binary | ios::trunc);
+	if (!out) return false;
+	if (h.size>0)
+	{
+		out.seekp(h.size-1);
+		out.put(0);
+	}
+	
+	//Memoire par point charge : le point et son pointeur (pour split), puis une dimension et
+	//l'objet recopies pour l'ecriture ; et en plus des points, le tampon de lecture et les
+	//histogrammes de splitFile
+	const size_t perrecord=sizeof(KDObj)+sizeof(const KDObj*)+sizeof(Coord)+sizeof(Object);
+	const size_t fixed=KDRecordReader::chunk*recsize+histbins*(sizeof(size_t)+2*sizeof(Coord));
+	const size_t maxrecords=std::max((budget>fixed ? budget-fixed : 0)/perrecord,t.bucket);
+	size_t temporaries=0;
+	vector<KDFilePart> todo(1);
+	todo[0].node=0;
+	todo[0].first=0;
+	todo[0].last=t.n;
+	todo[0].path=points;
+	todo[0].temporary=false;
+	bool ok=true;
+	while (ok && !todo.empty())
+	{
+		const KDFilePart part=todo.back();todo.pop_back();
+		const size_t count=part.last-part.first;
+		if (count>maxrecords)
+		{
+			KDFilePart left,right;
+			ostringstream name;
+			name << path << "." << ++temporaries;
+			left.path=name.str();
+			name.str("");
+			name << path << "." << ++temporaries;
+			right.path=name.str();
+			//Meme a moitie ecrits en cas d'echec, les fichiers temporaires sont effaces a la fin
+			left.temporary=right.temporary=true;
+			ok=t.splitFile(part,maxrecords,left,right);
+			if (part.temporary) remove(part.path.c_str());
+			todo.push_back(right);
+			todo.push_back(left);
+			continue;
+		}
+		
+		//Partie en memoire : son sous arbre est construit comme par build, puis ecrit a sa place
+		vector<KDObj> data;
+		data.reserve(count);
+		{
+			KDRecordReader in(part.path.c_str());
+			const char* rec;
+			while ((rec=in.next())!=NULL)
+			{
+				Coord c[Dim];
+				memcpy(c,rec,Dim*sizeof(Coord));
+				Object obj(Object::ERROR);
+				memcpy(&obj,rec+Dim*sizeof(Coord),sizeof(Object));
+				data.push_back(KDObj(obj,c));
+			}
+		}
+		if (part.temporary) remove(part.path.c_str());
+		if (data.size()!=count)
+		{
+			ok=false;
+			break;
+		}
+		vector<const KDObj*> ptrs(count);
+		for (size_t k=0;k<count;k++) ptrs[k]=&data[k];
+		t.split(ptrs,part.node,part.first);
+		if (count==0) continue;
+		vector<Coord> column(count);
+		for (short d=0;d<dimensions;d++)
+		{
+			for (size_t k=0;k<count;k++) column[k]=(*ptrs[k])[d];
+			out.seekp(h.coords+(d*t.n+part.first)*sizeof(Coord));
+			out.write(reinterpret_cast<const char*>(&column[0]),count*sizeof(Coord));
+		}
+		vector<Object> objs;
+		objs.reserve(count);
+		for (size_t k=0;k<count;k++) objs.push_back(ptrs[k]->obj);
+		out.seekp(h.objects+part.first*sizeof(Object));
+		out.write(reinterpret_cast<const char*>(&objs[0]),count*sizeof(Object));
+		ok=!out.fail();
+	}
+	//Fichiers temporaires restants en cas d'erreur
+	for (size_t i=0;i<todo.size();i++)
+		if (todo[i].temporary) remove(todo[i].path.c_str());
+	if (!ok) return false;
+	
+	out.seekp(0);
+	out.write(reinterpret_cast<const char*>(&h),sizeof(h));
+	if (t.nbleaves>1)
+	{
+		out.seekp(h.axis);
+		out.write(reinterpret_cast<const char*>(&t.axisData[0]),t.nbleaves-1);
+		out.seekp(h.splits);
+		out.write(reinterpret_cast<const char*>(&t.splitsData[0]),(t.nbleaves-1)*sizeof(Coord));
+	}
+	out.seekp(h.leaves);
+	out.write(reinterpret_cast<const char*>(&t.leavesData[0]),(t.nbleaves+1)*sizeof(size_t));
+	out.close();
+	return !out.fail();
+}
+
+//Plus proche voisin : descente vers la feuille, puis remontee sur les fils eloignes memorises
+//La pile a taille fixe suffit car l'arbre est complet
+template <class Object, int Dim, class Coord>
+typename KDFrozenTree<Object,Dim,Coord>::KDRes KDFrozenTree<Object,Dim,Coord>::findNN(const Coord* point) const
+{
+	if (n==0) return KDRes();
+	size_t best=0;
+	Dist bestdist=numeric_limits<Dist>::max();
+	Dist sq[maxbucket];
+	
+	size_t stacknode[maxdepth];
+	Dist stackbound[maxdepth];
+	int top=0;
+	size_t i=0;
+	while(true)
+	{
+		//On descend du cote du point, en memorisant l'autre cote
+		while(!isLeaf(i))
+		{
+			Dist diff=static_cast<Dist>(point[axis[i]])-static_cast<Dist>(splits[i]);
+			stacknode[top]=(diff<=0)?2*i+2:2*i+1;
+			stackbound[top]=diff*diff;
+			top++;
+			i=(diff<=0)?2*i+1:2*i+2;
+		}
+		//Tous les points de la feuille d'un coup
+		size_t first=leafFirst(i),last=leafLast(i);
+		if (quantized())
+		{
+			//Distances exactes seulement pour les points qui peuvent etre plus proches
+			qsqdist(i-(nbleaves-1),first,last,point,sq);
+			for (size_t k=first;k<last;k++)
+				if (sq[k-first]<=qslack(bestdist))
+				{
+					Dist d=exactsqdist(k,point);
+					if (d<bestdist) {bestdist=d;best=k;}
+				}
+		}
+		else
+		{
+			sqdist(first,last,point,sq);
+			for (size_t k=first;k<last;k++)
+				if (sq[k-first]<bestdist) {bestdist=sq[k-first];best=k;}
+		}
+		
+		//On remonte jusqu'au premier sous arbre pouvant contenir plus proche
+		do
+		{
+			if (top==0) return KDRes(objects[best],sqrt(bestdist));
+			top--;
+		} while (stackbound[top]>bestdist);
+		i=stacknode[top];
+	}
+}
+
+template <class Object, int Dim, class Coord>
+vector<typename KDFrozenTree<Object,Dim,Coord>::KDRes> KDFrozenTree<Object,Dim,Coord>::findNear(const Coord* point, const Dist radius) const
+{
+	vector<KDRes> neighbor;
+	if (n==0) return neighbor;
+	const Dist sqradius=radius*radius;
+	Dist sq[maxbucket];
+	
+	size_t stack[maxdepth];
+	int top=0;
+	size_t i=0;
+	while(true)
+	{
+		while(!isLeaf(i))
+		{
+			Dist diff=static_cast<Dist>(point[axis[i]])-static_cast<Dist>(splits[i]);
+			if (diff*diff<=sqradius) stack[top++]=(diff<=0)?2*i+2:2*i+1;
+			i=(diff<=0)?2*i+1:2*i+2;
+		}
+		//La racine carree n'est calculee que pour les points retenus
+		size_t first=leafFirst(i),last=leafLast(i);
+		if (quantized())
+		{
+			qsqdist(i-(nbleaves-1),first,last,point,sq);
+			const Dist bound=qslack(sqradius);
+			for (size_t k=first;k<last;k++)
+				if (sq[k-first]<=bound)
+				{
+					Dist d=exactsqdist(k,point);
+					if (d<=sqradius) neighbor.push_back(KDRes(objects[k],sqrt(d)));
+				}
+		}
+		else
+		{
+			sqdist(first,last,point,sq);
+			for (size_t k=first;k<last;k++)
+				if (sq[k-first]<=sqradius) neighbor.push_back(KDRes(objects[k],sqrt(sq[k-first])));
+		}
+		
+		if (top==0) break;
+		i=stack[--top];
+	}
+	return neighbor;
+}
+
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::stats(void) const
+{
+	cout << "NbNodes Stored : " << n << endl;
+	short depth=0;
+	for (size_t full=1;full<nbleaves;full*=2) depth++;
+	cout << "Leaves : " << nbleaves << " of at most " << bucket << " points , Depth : " << depth << endl;
+	cout << "Memory Used : " << (dimensions*n*sizeof(Coord) + n*sizeof(Object) + (nbleaves-1)*(1+sizeof(Coord)) + (nbleaves+1)*sizeof(size_t)) / 1024 << (mapped() ? " (mapped from a file)" : "") << endl;
+	if (quantized())
+		cout << "Quantized coordinates : " << (dimensions*n*sizeof(unsigned short) + nbleaves*Dim*(sizeof(Coord)+sizeof(Dist))) / 1024
+			<< " (exact ones : " << dimensions*n*sizeof(Coord) / 1024 << ")" << endl;
+}
+
+//Chaque coordonnee est ramenee a un entier de 16 bits sur la boite de sa feuille
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::quantize(void)
+{
+	qcoordsData.assign(dimensions*n,0);
+	qloData.assign(nbleaves*Dim,Coord());
+	qstepData.assign(nbleaves*Dim,0);
+	for (size_t leaf=0;leaf<nbleaves;leaf++)
+	{
+		const size_t node=leaf+nbleaves-1;
+		const size_t first=leafFirst(node),last=leafLast(node);
+		if (first==last) continue;
+		for (short d=0;d<dimensions;d++)
+		{
+			Coord lo=coords[d*n+first];
+			Coord hi=lo;
+			for (size_t k=first+1;k<last;k++)
+			{
+				lo=min(lo,coords[d*n+k]);
+				hi=max(hi,coords[d*n+k]);
+			}
+			const Dist step=static_cast<Dist>((static_cast<double>(hi)-static_cast<double>(lo))/65535.0);
+			qloData[leaf*Dim+d]=lo;
+			qstepData[leaf*Dim+d]=step;
+			for (size_t k=first;k<last;k++)
+			{
+				double q=(step>0) ? floor((static_cast<double>(coords[d*n+k])-static_cast<double>(lo))/step) : 0.0;
+				qcoordsData[d*n+k]=static_cast<unsigned short>(min(max(q,0.0),65535.0));
+			}
+		}
+	}
+	qview();
+}
+
+//Boites englobantes exactes des noeuds, des feuilles vers la racine
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::boxes(vector<Coord>& lo,vector<Coord>& hi) const
+{
+	const size_t nodes=2*nbleaves-1;
+	lo.assign(nodes*Dim,numeric_limits<Coord>::max());
+	hi.assign(nodes*Dim,KDLowest<Coord>());
+	for (size_t i=nodes;i>0;i--)
+	{
+		const size_t node=i-1;
+		if (isLeaf(node))
+		{
+			for (size_t k=leafFirst(node);k<leafLast(node);k++)
+				for (short d=0;d<dimensions;d++)
+				{
+					lo[node*Dim+d]=min(lo[node*Dim+d],coords[d*n+k]);
+					hi[node*Dim+d]=max(hi[node*Dim+d],coords[d*n+k]);
+				}
+		}
+		else
+		{
+			for (short d=0;d<dimensions;d++)
+			{
+				lo[node*Dim+d]=min(lo[(2*node+1)*Dim+d],lo[(2*node+2)*Dim+d]);
+				hi[node*Dim+d]=max(hi[(2*node+1)*Dim+d],hi[(2*node+2)*Dim+d]);
+			}
+		}
+	}
+}
+
+template <class Object, int Dim, class Coord>
+KDFrozenTree<Object,Dim,Coord>::KDJoin::KDJoin(const KDFrozenTree& a,const KDFrozenTree& b,const Dist radius)
+	: ta(a), tb(b), self(&a==&b), sqradius(radius*radius)
+{
+	ta.boxes(alo,ahi);
+	if (self)
+	{
+		blo=alo;
+		bhi=ahi;
+	}
+	else tb.boxes(blo,bhi);
+}
+
+//Distance au carre entre les boites des noeuds a (de ta) et b (de tb), 0 si elles se touchent
+template <class Object, int Dim, class Coord>
+typename KDFrozenTree<Object,Dim,Coord>::Dist KDFrozenTree<Object,Dim,Coord>::KDJoin::gap(size_t a,size_t b) const
+{
+	Dist sum=0;
+	for (short d=0;d<Dim;d++)
+	{
+		//Boite vide : lo>hi, l'ecart est alors enorme
+		if (alo[a*Dim+d]>ahi[a*Dim+d] || blo[b*Dim+d]>bhi[b*Dim+d]) return numeric_limits<Dist>::max();
+		Dist g=0;
+		if (blo[b*Dim+d]>ahi[a*Dim+d]) g=static_cast<Dist>(blo[b*Dim+d])-static_cast<Dist>(ahi[a*Dim+d]);
+		else if (alo[a*Dim+d]>bhi[b*Dim+d]) g=static_cast<Dist>(alo[a*Dim+d])-static_cast<Dist>(bhi[b*Dim+d]);
+		sum+=g*g;
+	}
+	return sum;
+}
+
+template <class Object, int Dim, class Coord>
+typename KDFrozenTree<Object,Dim,Coord>::Dist KDFrozenTree<Object,Dim,Coord>::KDJoin::extent(const vector<Coord>& lo,const vector<Coord>& hi,size_t node) const
+{
+	Dist sum=0;
+	for (short d=0;d<Dim;d++)
+		if (hi[node*Dim+d]>lo[node*Dim+d]) sum+=static_cast<Dist>(hi[node*Dim+d])-static_cast<Dist>(lo[node*Dim+d]);
+	return sum;
+}
+
+//Avec un seul arbre, la paire (a,a) donne (g,g), (g,d) et (d,d) : chaque paire d'objets
+//n'est vue qu'une fois. Sinon on coupe le noeud le plus etendu des deux.
+template <class Object, int Dim, class Coord>
+bool KDFrozenTree<Object,Dim,Coord>::KDJoin::split(size_t a,size_t b,vector<size_t>& todo) const
+{
+	const bool leafa=ta.isLeaf(a),leafb=tb.isLeaf(b);
+	if (leafa && leafb) return false;
+	size_t pairs[6];
+	int nb=0;
+	if (self && a==b)
+	{
+		pairs[0]=2*a+1;pairs[1]=2*a+1;
+		pairs[2]=2*a+1;pairs[3]=2*a+2;
+		pairs[4]=2*a+2;pairs[5]=2*a+2;
+		nb=3;
+	}
+	else if (leafb || (!leafa && extent(alo,ahi,a)>=extent(blo,bhi,b)))
+	{
+		pairs[0]=2*a+1;pairs[1]=b;
+		pairs[2]=2*a+2;pairs[3]=b;
+		nb=2;
+	}
+	else
+	{
+		pairs[0]=a;pairs[1]=2*b+1;
+		pairs[2]=a;pairs[3]=2*b+2;
+		nb=2;
+	}
+	for (int i=0;i<nb;i++)
+		if (gap(pairs[2*i],pairs[2*i+1])<=sqradius)
+		{
+			todo.push_back(pairs[2*i]);
+			todo.push_back(pairs[2*i+1]);
+		}
+	return true;
+}
+
+//Paires d'objets de deux feuilles : chaque point de a contre tous ceux de b (noyau vectoriel)
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::KDJoin::leaves(size_t a,size_t b,vector<KDPair>& out) const
+{
+	Dist sq[maxbucket];
+	Coord point[Dim];
+	const size_t bfirst=tb.leafFirst(b),blast=tb.leafLast(b);
+	for (size_t k=ta.leafFirst(a);k<ta.leafLast(a);k++)
+	{
+		//Dans une meme feuille, seulement les points suivants
+		const size_t first=(self && a==b) ? k+1 : bfirst;
+		if (first>=blast) continue;
+		for (short d=0;d<Dim;d++) point[d]=ta.coords[d*ta.n+k];
+		tb.sqdist(first,blast,point,sq);
+		for (size_t j=first;j<blast;j++)
+			if (sq[j-first]<=sqradius) out.push_back(KDPair(ta.objects[k],tb.objects[j],sqrt(sq[j-first])));
+	}
+}
+
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::KDJoin::run(size_t a,size_t b,vector<KDPair>& out) const
+{
+	vector<size_t> todo;
+	todo.push_back(a);todo.push_back(b);
+	while(!todo.empty())
+	{
+		b=todo.back();todo.pop_back();
+		a=todo.back();todo.pop_back();
+		if (!split(a,b,todo)) leaves(a,b,out);
+	}
+}
+
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::KDJoinBody::operator () (size_t first,size_t last,int)
+{
+	for (size_t i=first;i<last;i++) join.run(tasks[2*i],tasks[2*i+1],results[i]);
+}
+
+//En parallele, les paires de noeuds sont d'abord coupees niveau par niveau jusqu'a en avoir
+//assez pour occuper tous les threads, puis chacune est traitee par un thread
+template <class Object, int Dim, class Coord>
+vector<typename KDFrozenTree<Object,Dim,Coord>::KDPair> KDFrozenTree<Object,Dim,Coord>::join(const KDFrozenTree& other,const Dist radius,KDThreadPool* pool) const
+{
+	vector<KDPair> result;
+	if (n==0 || other.n==0) return result;
+	const KDJoin j(*this,other,radius);
+	if (pool==NULL)
+	{
+		j.run(0,0,result);
+		return result;
+	}
+	
+	vector<size_t> tasks,next;
+	tasks.push_back(0);tasks.push_back(0);
+	bool more=true;
+	while (more && tasks.size()/2<static_cast<size_t>(16*pool->size()))
+	{
+		more=false;
+		next.clear();
+		for (size_t i=0;i<tasks.size();i+=2)
+		{
+			if (j.split(tasks[i],tasks[i+1],next)) more=true;
+			else {next.push_back(tasks[i]);next.push_back(tasks[i+1]);}
+		}
+		tasks.swap(next);
+	}
+	vector< vector<KDPair> > results(tasks.size()/2);
+	KDJoinBody body(j,tasks,results);
+	pool->parallelFor(0,results.size(),1,body);
+	size_t total=0;
+	for (size_t i=0;i<results.size();i++) total+=results[i].size();
+	result.reserve(total);
+	for (size_t i=0;i<results.size();i++) result.insert(result.end(),results[i].begin(),results[i].end());
+	return result;
+}
+
+//Les points de la feuille node, sauf self, candidats aux k plus proches de point (tas max)
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::knnVisit(size_t node,size_t self,const Coord* point,size_t k,vector< pair<Dist,size_t> >& heap) const
+{
+	Dist sq[maxbucket];
+	size_t first=leafFirst(node),last=leafLast(node);
+	sqdist(first,last,point,sq);
+	for (size_t j=first;j<last;j++)
+	{
+		if (j==self) continue;
+		if (heap.size()<k)
+		{
+			heap.push_back(pair<Dist,size_t>(sq[j-first],j));
+			push_heap(heap.begin(),heap.end());
+		}
+		else if (sq[j-first]<heap.front().first)
+		{
+			pop_heap(heap.begin(),heap.end());
+			heap.back()=pair<Dist,size_t>(sq[j-first],j);
+			push_heap(heap.begin(),heap.end());
+		}
+	}
+}
+
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::knnLeaf(size_t leaf,KDGraph& graph,vector< pair<Dist,size_t> >& heap) const
+{
+	const size_t k=graph.k;
+	const size_t node=leaf+nbleaves-1;
+	Coord point[Dim];
+	size_t stacknode[maxdepth];
+	Dist stackbound[maxdepth];
+	for (size_t p=leafFirst(node);p<leafLast(node);p++)
+	{
+		for (short d=0;d<dimensions;d++) point[d]=coords[d*n+p];
+		//Sa propre feuille d'abord : la borne est serree avant meme de partir de la racine
+		heap.clear();
+		knnVisit(node,p,point,k,heap);
+		int top=0;
+		size_t i=0;
+		while(true)
+		{
+			while(!isLeaf(i))
+			{
+				Dist diff=static_cast<Dist>(point[axis[i]])-static_cast<Dist>(splits[i]);
+				stacknode[top]=(diff<=0)?2*i+2:2*i+1;
+				stackbound[top]=diff*diff;
+				top++;
+				i=(diff<=0)?2*i+1:2*i+2;
+			}
+			if (i!=node) knnVisit(i,p,point,k,heap);
+			while (top>0 && heap.size()==k && stackbound[top-1]>heap.front().first) top--;
+			if (top==0) break;
+			i=stacknode[--top];
+		}
+		sort_heap(heap.begin(),heap.end());
+		for (size_t r=0;r<k;r++)
+		{
+			graph.neighbors[p*k+r]=heap[r].second;
+			graph.dists[p*k+r]=sqrt(heap[r].first);
+		}
+	}
+}
+
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::KDGraphBody::operator () (size_t first,size_t last,int worker)
+{
+	for (size_t leaf=first;leaf<last;leaf++) tree.knnLeaf(leaf,graph,heaps[worker]);
+}
+
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::buildKNNGraph(size_t k,KDGraph& graph) const
+{
+	graph.k=(n==0) ? 0 : min(k,n-1);
+	graph.neighbors.assign(n*graph.k,0);
+	graph.dists.assign(n*graph.k,0);
+	if (graph.k==0) return;
+	vector< pair<Dist,size_t> > heap;
+	for (size_t leaf=0;leaf<nbleaves;leaf++) knnLeaf(leaf,graph,heap);
+}
+
+//Chaque feuille remplit ses propres lignes du graphe : le resultat ne depend pas des threads
+template <class Object, int Dim, class Coord>
+void KDFrozenTree<Object,Dim,Coord>::buildKNNGraph(size_t k,KDGraph& graph,KDThreadPool& pool) const
+{
+	graph.k=(n==0) ? 0 : min(k,n-1);
+	graph.neighbors.assign(n*graph.k,0);
+	graph.dists.assign(n*graph.k,0);
+	if (graph.k==0) return;
+	KDGraphBody body(*this,graph,pool.size());
+	pool.parallelFor(0,nbleaves,16,body);
+}
+
+//Sauvegarde directe d'un KDTree, definie ici car elle passe par sa version figee
+template <class Object, int Dim, class Coord>
+bool KDTree<Object,Dim,Coord>::save(const char* path,size_t bucket) const
+{
+	return KDFrozenTree<Object,Dim,Coord>(*this,bucket).save(path);
+}
@@ -0,0 +1,347 @@
+#ifndef KDFROZENTREE_HH
+#define KDFROZENTREE_HH 1
+
+#include "KDTree.hh"
+#include "KDKernel.hh"
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//Paire d'objets a la distance dist l'un de l'autre (pairsWithin)
+template <class Object, int Dim=DIMENSIONS, class Coord=float> class KDPairDist
+{
+	public:
+	typedef typename KDDistance<Coord>::type Dist;
+	Dist dist;
+	Object first;
+	Object second;
+	
+	KDPairDist(const Object& a=Object::ERROR,const Object& b=Object::ERROR,Dist d=-1) : dist(d), first(a), second(b) {}
+};
+
+//Graphe des k plus proches voisins des points d'un arbre fige, par indices dans l'arbre :
+//les voisins du point i (object(i)) sont neighbors[i*k] a neighbors[i*k+k-1],
+//par distance croissante, a dists[i*k] a dists[i*k+k-1]
+template <class Coord=float> class KDKNNGraph
+{
+	public:
+	typedef typename KDDistance<Coord>::type Dist;
+	size_t k;
+	vector<size_t> neighbors;
+	vector<Dist> dists;
+	
+	KDKNNGraph() : k(0) {}
+	//Nombre de points
+	size_t size(void) const { return k==0 ? 0 : neighbors.size()/k; }
+	//Voisins du point i
+	const size_t* of(size_t i) const { return &neighbors[i*k]; }
+};
+
+//Version figee (statique) d'un KDTree
+//Les noeuds de coupe forment un arbre complet range en largeur d'abord (ordre de tas) :
+//les fils du noeud i sont 2i+1 et 2i+2, il n'y a donc aucun pointeur a suivre.
+//Les feuilles sont des paquets d'au plus bucket points, ranges a la suite.
+//Les coordonnees sont stockees par dimension (SoA) : coords[d*n+k] pour le point k,
+//une feuille est donc testee d'un coup par les noyaux vectoriels de KDKernel.
+//Un arbre fige peut etre sauve dans un fichier puis projete en memoire (mmap) tel quel :
+//les tableaux sont reperes par leur position dans le fichier, sans aucun pointeur.
+//Object est alors recopie octet par octet : il doit etre trivialement copiable (POD).
+template <class Object, int Dim=DIMENSIONS, class Coord=float> class KDFrozenTree
+{
+	static const int dimensions=Dim;
+	//Profondeur maximale (indices sur 64 bits)
+	static const int maxdepth=64;
+	
+	public:
+	typedef KDTree<Object,Dim,Coord> Tree;
+	typedef typename Tree::KDObj KDObj;
+	typedef typename Tree::KDRes KDRes;
+	typedef typename Tree::Dist Dist;
+	typedef KDPairDist<Object,Dim,Coord> KDPair;
+	typedef KDKNNGraph<Coord> KDGraph;
+	//Taille maximale des feuilles
+	static const size_t maxbucket=256;
+	
+	//Version du format de fichier
+	static const unsigned int fileversion=2;
+	
+	private:
+	size_t n;
+	size_t bucket;
+	size_t nbleaves;
+	//Points, dans l'ordre des feuilles
+	const Coord* coords;
+	const Object* objects;
+	//Noeuds de coupe (nbleaves-1) : dimension et valeur, a gauche <= valeur <= a droite
+	const unsigned char* axis;
+	const Coord* splits;
+	//Premier point de chaque feuille, plus la fin
+	const size_t* leaves;
+	//Coordonnees quantifiees sur 16 bits (SoA, comme coords), relativement a la boite de chaque
+	//feuille : la coordonnee d du point k est qlo+q*qstep a un pas pres (NULL sans quantize)
+	const unsigned short* qcoords;
+	const Coord* qlo;
+	const Dist* qstep;
+	
+	//Les tableaux ci dessus pointent soit dans ceux ci, pour un arbre construit en memoire,
+	//soit dans la projection d'un fichier
+	vector<Coord> coordsData;
+	vector<Object> objectsData;
+	vector<unsigned char> axisData;
+	vector<Coord> splitsData;
+	vector<size_t> leavesData;
+	vector<unsigned short> qcoordsData;
+	vector<Coord> qloData;
+	vector<Dist> qstepData;
+	void* mapping;
+	size_t mapsize;
+	//Copie du fichier quand mmap n'est pas disponible
+	vector<char> image;
+	
+	//Entete du fichier, les tableaux suivent, alignes sur 64 octets
+	struct KDFileHeader
+	{
+		char magic[8];
+		unsigned int version;
+		//0x01020304 dans l'ordre des octets de la machine qui a ecrit le fichier
+		unsigned int endian;
+		//Types et tailles, qui doivent correspondre a ceux de l'arbre qui lit le fichier
+		unsigned int dim;
+		unsigned int coordkind;
+		unsigned int coordsize;
+		unsigned int objectsize;
+		unsigned int sizesize;
+		size_t n,bucket,nbleaves;
+		//Position des tableaux depuis le debut du fichier, et taille totale
+		//Les coordonnees quantifiees sont a 0 si l'arbre n'a pas ete quantifie
+		size_t coords,objects,axis,splits,leaves;
+		size_t qcoords,qlo,qstep;
+		size_t size;
+	};
+	
+	//Foncteur de comparaison des objets selon une dimension (pour nth_element)
+	class KDObjCompare
+	{
+		short dim;
+		public:
+		KDObjCompare(short d) : dim(d) {}
+		bool operator () (const KDObj* a,const KDObj* b) const { return (*a)[dim] < (*b)[dim]; }
+	};
+	
+	//Jointure par distance de deux arbres (ou d'un arbre avec lui meme) : parcours simultane
+	//des deux arbres, les paires de noeuds dont les boites sont a plus de radius sont ecartees
+	class KDJoin
+	{
+		const KDFrozenTree& ta;
+		const KDFrozenTree& tb;
+		const bool self;
+		const Dist sqradius;
+		//Boites englobantes exactes des noeuds, Dim coordonnees par noeud (vide : lo>hi)
+		vector<Coord> alo,ahi,blo,bhi;
+		Dist gap(size_t a,size_t b) const;
+		Dist extent(const vector<Coord>& lo,const vector<Coord>& hi,size_t node) const;
+		void leaves(size_t a,size_t b,vector<KDPair>& out) const;
+		public:
+		KDJoin(const KDFrozenTree& a,const KDFrozenTree& b,const Dist radius);
+		//Ajoute a todo les paires de fils qui remplacent (a,b), false si a et b sont des feuilles
+		bool split(size_t a,size_t b,vector<size_t>& todo) const;
+		//Toutes les paires d'objets issues de la paire de noeuds (a,b)
+		void run(size_t a,size_t b,vector<KDPair>& out) const;
+	};
+	friend class KDJoin;
+	//Traitement en parallele des paires de noeuds de tasks, resultats de la paire i dans results[i]
+	class KDJoinBody : public KDThreadPool::Body
+	{
+		const KDJoin& join;
+		const vector<size_t>& tasks;
+		vector< vector<KDPair> >& results;
+		public:
+		KDJoinBody(const KDJoin& j,const vector<size_t>& t,vector< vector<KDPair> >& r) : join(j), tasks(t), results(r) {}
+		void operator () (size_t first,size_t last,int worker);
+	};
+	
+	//Construction en parallele du graphe des k plus proches voisins, par paquets de feuilles
+	class KDGraphBody : public KDThreadPool::Body
+	{
+		const KDFrozenTree& tree;
+		KDGraph& graph;
+		vector< vector< pair<Dist,size_t> > > heaps;
+		public:
+		KDGraphBody(const KDFrozenTree& t,KDGraph& g,int nbthreads) : tree(t), graph(g), heaps(nbthreads) {}
+		void operator () (size_t first,size_t last,int worker);
+	};
+	friend class KDGraphBody;
+	
+	//Lecture sequentielle par morceaux d'un fichier de points bruts (voir buildFile)
+	class KDRecordReader
+	{
+		ifstream in;
+		vector<char> buffer;
+		size_t pos,len;
+		public:
+		static const size_t recsize=Dim*sizeof(Coord)+sizeof(Object);
+		//Points lus d'un coup
+		static const size_t chunk=4096;
+		KDRecordReader(const char* path) : in(path,ios::in | ios::binary), buffer(chunk*recsize), pos(0), len(0) {}
+		//Point suivant (coordonnees puis objet), NULL a la fin du fichier
+		const char* next(void)
+		{
+			if (pos==len)
+			{
+				in.read(&buffer[0],buffer.size());
+				len=in.gcount()/recsize*recsize;
+				pos=0;
+				if (len==0) return NULL;
+			}
+			const char* rec=&buffer[pos];
+			pos+=recsize;
+			return rec;
+		}
+		static Coord coord(const char* rec,short d) { Coord c; memcpy(&c,rec+d*sizeof(Coord),sizeof(Coord)); return c; }
+	};
+	//Partie du fichier de points qui reste a placer sous le noeud node, aux positions [first,last)
+	struct KDFilePart
+	{
+		size_t node,first,last;
+		string path;
+		bool temporary;
+	};
+	
+	//Fonctions de manipulation internes
+	void build(vector<const KDObj*>& data);
+	void split(vector<const KDObj*>& data,size_t root,size_t offset);
+	//Coupe une partie trop grande en deux fichiers temporaires, par la mediane de sa dimension
+	//la plus etendue, en quelques lectures sequentielles ; maxrecords : points tenant en memoire
+	static const size_t histbins=4096;
+	bool splitFile(const KDFilePart& part,size_t maxrecords,KDFilePart& left,KDFilePart& right);
+	//k plus proches voisins des points de la feuille leaf, dans graph (heap : tas de travail)
+	void knnLeaf(size_t leaf,KDGraph& graph,vector< pair<Dist,size_t> >& heap) const;
+	void knnVisit(size_t node,size_t self,const Coord* point,size_t k,vector< pair<Dist,size_t> >& heap) const;
+	void boxes(vector<Coord>& lo,vector<Coord>& hi) const;
+	vector<KDPair> join(const KDFrozenTree& other,const Dist radius,KDThreadPool* pool) const;
+	//Fait pointer les tableaux sur les donnees construites en memoire
+	void view(void);
+	void qview(void);
+	void copy(const KDFrozenTree& tree);
+	void unmap(void);
+	KDFileHeader header(void) const;
+	//Positions des tableaux d'apres h.n et h.nbleaves
+	static void layout(KDFileHeader& h,bool quant);
+	static inline size_t align(size_t pos) { return (pos+63)/64*64; }
+	static inline unsigned int coordKind(void) { return (numeric_limits<Coord>::is_integer ? 1 : 0) | (numeric_limits<Coord>::is_signed ? 2 : 0); }
+	inline bool isLeaf(size_t node) const { return node>=nbleaves-1; }
+	inline size_t leafFirst(size_t node) const { return leaves[node-(nbleaves-1)]; }
+	inline size_t leafLast(size_t node) const { return leaves[node-(nbleaves-1)+1]; }
+	//Distances au carre minimales possibles entre point et les points d'une feuille (leaf : son
+	//numero) d'apres leurs valeurs quantifiees. Avec un pas de marge de chaque cote, elles ne
+	//depassent la distance exacte que des erreurs d'arrondi relatives, couvertes par qslack.
+	inline void qsqdist(size_t leaf,size_t first,size_t last,const Coord* point,Dist* out) const
+	{
+		Dist u[Dim];
+		Dist step2[Dim];
+		Dist base=0;
+		for (short d=0;d<Dim;d++)
+		{
+			const Dist step=qstep[leaf*Dim+d];
+			const Dist p=static_cast<Dist>(point[d])-static_cast<Dist>(qlo[leaf*Dim+d]);
+			//Pas nul : tous les points de la feuille ont cette coordonnee (et la valeur 0)
+			u[d]=(step==0) ? 0 : p/step;
+			step2[d]=step*step;
+			if (step==0) base+=p*p;
+		}
+		KDQuantKernel<Dist,Dim>::sqdist(&qcoords[first],n,last-first,u,step2,base,out);
+	}
+	static inline Dist qslack(Dist bound) { return bound+bound/10000; }
+	//Distance au carre exacte, calculee comme par les noyaux de KDKernel
+	inline Dist exactsqdist(size_t k,const Coord* point) const
+	{
+		Dist sum=0;
+		for (short d=0;d<Dim;d++)
+		{
+			Dist diff=static_cast<Dist>(point[d])-static_cast<Dist>(coords[d*n+k]);
+			sum+=diff*diff;
+		}
+		return sum;
+	}
+	//Distances au carre entre point et les points d'une feuille
+	inline void sqdist(size_t first,size_t last,const Coord* point,Dist* out) const
+	{
+		KDKernel<Coord,Dist,Dim>::sqdist(coords+first,n,last-first,point,out);
+	}
+	
+	public:
+	
+	//Constructeurs et destructeur
+	KDFrozenTree() : n(0), bucket(1), nbleaves(1), leavesData(2,0), mapping(NULL), mapsize(0) {view();}
+	//Fige le contenu d'un KDTree, qui n'est pas modifie
+	//bucket : nombre maximal de points par feuille (1 a maxbucket)
+	KDFrozenTree(const Tree& tree,size_t bucket=16);
+	//Fige directement une suite d'objets (KDObj), sans passer par un KDTree
+	template <class Iterator> KDFrozenTree(Iterator first,Iterator last,size_t bucket=16);
+	//Une copie est toujours construite en memoire, meme si l'original est projete d'un fichier
+	KDFrozenTree(const KDFrozenTree& tree) : mapping(NULL), mapsize(0) {copy(tree);}
+	KDFrozenTree& operator = (const KDFrozenTree& tree);
+	~KDFrozenTree() {unmap();}
+	
+	//Sauve l'arbre dans un fichier binaire, pour la meme architecture (boutisme, tailles des types)
+	bool save(const char* path) const;
+	//Remplace le contenu par celui d'un fichier, projete en lecture seule et partage entre processus :
+	//aucun decodage, l'arbre est utilisable aussitot. Renvoie false (arbre inchange) si le fichier
+	//est illisible ou ne correspond pas a ce type d'arbre.
+	bool mapFile(const char* path);
+	bool mapped(void) const { return mapping!=NULL || !image.empty(); }
+	//Ecrit le fichier d'un arbre fige (a projeter ensuite avec mapFile) a partir d'un fichier de
+	//points bruts : pour chaque point, ses Dim coordonnees puis son objet, octet par octet.
+	//Les points ne sont jamais tous en memoire : tant qu'une partie depasse budget octets,
+	//elle est coupee en deux fichiers temporaires (path.1, path.2...) par sa mediane, sinon son
+	//sous arbre est construit en memoire et ecrit a sa place. budget compte les points charges
+	//et toutes les copies de travail ; seuls les noeuds de coupe (quelques octets par feuille)
+	//s'y ajoutent, en memoire d'un bout a l'autre.
+	static bool buildFile(const char* points,const char* path,size_t budget,size_t bucket=16);
+	//Ajoute une copie des coordonnees sur 16 bits par dimension, relative a la boite de chaque
+	//feuille. Les recherches ecartent alors les points sur ces valeurs (de facon sure) et ne lisent
+	//les coordonnees exactes que des candidats : les resultats restent exacts, mais les feuilles
+	//sont parcourues sur 2 octets par coordonnee. Les coordonnees quantifiees sont sauvees avec
+	//l'arbre : projete d'un fichier, il ne lit alors les coordonnees exactes que des candidats,
+	//les autres restent sur le disque.
+	void quantize(void);
+	bool quantized(void) const { return qlo!=NULL; }
+	
+	//Requetes, equivalentes a celles du KDTree
+	KDRes findNN(const Coord* point) const;
+	vector<KDRes> findNear(const Coord* point,const Dist radius) const;
+	long count(void) const { return n; }
+	void stats(void) const;
+	
+	//Toutes les paires d'objets a au plus radius l'un de l'autre, chacune une seule fois,
+	//en un seul parcours simultane de l'arbre avec lui meme (au lieu d'un findNear par objet)
+	vector<KDPair> pairsWithin(const Dist radius) const { return join(*this,radius,NULL); }
+	//Paires (objet de cet arbre, objet de other) a au plus radius l'un de l'autre
+	vector<KDPair> pairsWithin(const KDFrozenTree& other,const Dist radius) const { return join(other,radius,NULL); }
+	//Memes paires, calculees sur les threads de pool (l'ordre des paires peut differer)
+	vector<KDPair> pairsWithin(const Dist radius,KDThreadPool& pool) const { return join(*this,radius,&pool); }
+	vector<KDPair> pairsWithin(const KDFrozenTree& other,const Dist radius,KDThreadPool& pool) const { return join(other,radius,&pool); }
+	
+	//Graphe des k plus proches voisins (lui meme exclu) de tous les points, en une passe :
+	//les points sont traites dans l'ordre des feuilles, ceux d'une meme feuille suivent donc
+	//les memes chemins, et chaque recherche part des points de sa propre feuille.
+	//k est ramene a count()-1 s'il le depasse.
+	void buildKNNGraph(size_t k,KDGraph& graph) const;
+	void buildKNNGraph(size_t k,KDGraph& graph,KDThreadPool& pool) const;
+	//Objets et coordonnees par indice, dans l'ordre des feuilles (celui de KDKNNGraph)
+	const Object& object(size_t i) const { return objects[i]; }
+	Coord coord(size_t i,short d) const { return coords[d*n+i]; }
+};
+
+//Because of the template class, implementation must be here :(
+#include "KDFrozenTree.cc"
+
+#endif /* !KDFROZENTREE_HH */
@@ -0,0 +1,189 @@
+#ifndef KDKERNEL_HH
+#define KDKERNEL_HH 1
+
+#include <cstddef>
+
+//Noyaux de calcul des distances sur des points stockes par dimension (SoA) :
+//la coordonnee d du point k est soa[d*stride+k].
+//Les versions SSE/AVX sont choisies a la compilation (-msse, -mavx...),
+//definir NOSIMD pour forcer la version scalaire.
+#if !defined(NOSIMD) && defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+#if !defined(NOSIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if !defined(NOSIMD) && defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+//Version scalaire
+template <class Coord, class Dist, int Dim> struct KDKernel
+{
+	//Distances au carre entre point et les nb points de soa, dans out
+	static inline void sqdist(const Coord* soa,size_t stride,size_t nb,const Coord* point,Dist* out)
+	{
+		for (size_t k=0;k<nb;k++)
+		{
+			Dist sum=0;
+			for (int d=0;d<Dim;d++)
+			{
+				Dist diff=static_cast<Dist>(point[d])-static_cast<Dist>(soa[d*stride+k]);
+				sum+=diff*diff;
+			}
+			out[k]=sum;
+		}
+	}
+};
+
+#if !defined(NOSIMD) && defined(__SSE__)
+//Coordonnees float : 4 points par instruction (8 avec AVX)
+template <int Dim> struct KDKernel<float,float,Dim>
+{
+	static inline void sqdist(const float* soa,size_t stride,size_t nb,const float* point,float* out)
+	{
+		size_t k=0;
+#ifdef __AVX__
+		for (;k+8<=nb;k+=8)
+		{
+			__m256 acc=_mm256_setzero_ps();
+			for (int d=0;d<Dim;d++)
+			{
+				__m256 diff=_mm256_sub_ps(_mm256_set1_ps(point[d]),_mm256_loadu_ps(soa+d*stride+k));
+				acc=_mm256_add_ps(acc,_mm256_mul_ps(diff,diff));
+			}
+			_mm256_storeu_ps(out+k,acc);
+		}
+#endif
+		for (;k+4<=nb;k+=4)
+		{
+			__m128 acc=_mm_setzero_ps();
+			for (int d=0;d<Dim;d++)
+			{
+				__m128 diff=_mm_sub_ps(_mm_set1_ps(point[d]),_mm_loadu_ps(soa+d*stride+k));
+				acc=_mm_add_ps(acc,_mm_mul_ps(diff,diff));
+			}
+			_mm_storeu_ps(out+k,acc);
+		}
+		for (;k<nb;k++)
+		{
+			float sum=0.0f;
+			for (int d=0;d<Dim;d++)
+			{
+				float diff=point[d]-soa[d*stride+k];
+				sum+=diff*diff;
+			}
+			out[k]=sum;
+		}
+	}
+};
+#endif
+
+#if !defined(NOSIMD) && defined(__SSE2__)
+//Coordonnees double : 2 points par instruction (4 avec AVX)
+template <int Dim> struct KDKernel<double,double,Dim>
+{
+	static inline void sqdist(const double* soa,size_t stride,size_t nb,const double* point,double* out)
+	{
+		size_t k=0;
+#ifdef __AVX__
+		for (;k+4<=nb;k+=4)
+		{
+			__m256d acc=_mm256_setzero_pd();
+			for (int d=0;d<Dim;d++)
+			{
+				__m256d diff=_mm256_sub_pd(_mm256_set1_pd(point[d]),_mm256_loadu_pd(soa+d*stride+k));
+				acc=_mm256_add_pd(acc,_mm256_mul_pd(diff,diff));
+			}
+			_mm256_storeu_pd(out+k,acc);
+		}
+#endif
+		for (;k+2<=nb;k+=2)
+		{
+			__m128d acc=_mm_setzero_pd();
+			for (int d=0;d<Dim;d++)
+			{
+				__m128d diff=_mm_sub_pd(_mm_set1_pd(point[d]),_mm_loadu_pd(soa+d*stride+k));
+				acc=_mm_add_pd(acc,_mm_mul_pd(diff,diff));
+			}
+			_mm_storeu_pd(out+k,acc);
+		}
+		for (;k<nb;k++)
+		{
+			double sum=0.0;
+			for (int d=0;d<Dim;d++)
+			{
+				double diff=point[d]-soa[d*stride+k];
+				sum+=diff*diff;
+			}
+			out[k]=sum;
+		}
+	}
+};
+#endif
+
+//Distances au carre minimales entre un point et des points quantifies sur 16 bits (SoA) :
+//u[d] est la position du point en pas de quantification, step2[d] le carre du pas, et chaque
+//valeur v represente l'intervalle [v-1,v+2] (un pas de marge de chaque cote).
+//base est ajoute a chaque distance.
+template <class Dist, int Dim> struct KDQuantKernel
+{
+	static inline void sqdist(const unsigned short* soa,size_t stride,size_t nb,const Dist* u,const Dist* step2,Dist base,Dist* out)
+	{
+		for (size_t k=0;k<nb;k++)
+		{
+			Dist sum=base;
+			for (int d=0;d<Dim;d++)
+			{
+				const Dist v=static_cast<Dist>(soa[d*stride+k]);
+				const Dist below=v-1-u[d],above=u[d]-v-2;
+				Dist g=(below>above) ? below : above;
+				g=(g>0) ? g : 0;
+				sum+=g*g*step2[d];
+			}
+			out[k]=sum;
+		}
+	}
+};
+
+#if !defined(NOSIMD) && defined(__SSE2__)
+//Distances float : 4 points par instruction, les entiers 16 bits sont convertis a la volee
+template <int Dim> struct KDQuantKernel<float,Dim>
+{
+	static inline void sqdist(const unsigned short* soa,size_t stride,size_t nb,const float* u,const float* step2,float base,float* out)
+	{
+		size_t k=0;
+		const __m128i zero=_mm_setzero_si128();
+		for (;k+4<=nb;k+=4)
+		{
+			__m128 acc=_mm_set1_ps(base);
+			for (int d=0;d<Dim;d++)
+			{
+				__m128i q=_mm_loadl_epi64(reinterpret_cast<const __m128i*>(soa+d*stride+k));
+				__m128 v=_mm_cvtepi32_ps(_mm_unpacklo_epi16(q,zero));
+				__m128 ud=_mm_set1_ps(u[d]);
+				__m128 below=_mm_sub_ps(_mm_sub_ps(v,_mm_set1_ps(1.0f)),ud);
+				__m128 above=_mm_sub_ps(_mm_sub_ps(ud,v),_mm_set1_ps(2.0f));
+				__m128 g=_mm_max_ps(_mm_max_ps(below,above),_mm_setzero_ps());
+				acc=_mm_add_ps(acc,_mm_mul_ps(_mm_mul_ps(g,g),_mm_set1_ps(step2[d])));
+			}
+			_mm_storeu_ps(out+k,acc);
+		}
+		for (;k<nb;k++)
+		{
+			float sum=base;
+			for (int d=0;d<Dim;d++)
+			{
+				const float v=static_cast<float>(soa[d*stride+k]);
+				const float below=v-1-u[d],above=u[d]-v-2;
+				float g=(below>above) ? below : above;
+				g=(g>0) ? g : 0;
+				sum+=g*g*step2[d];
+			}
+			out[k]=sum;
+		}
+	}
+};
+#endif
+
+#endif /* !KDKERNEL_HH */
@@ -0,0 +1,91 @@
+#ifndef KDPOOL_HH
+#define KDPOOL_HH 1
+
+#include <vector>
+#include <cstdlib>
+#include <new>
+using namespace std;
+
+//Allocateur par blocs pour les noeuds d'un KDTree
+//Les elements sont places dans des blocs de taille fixe, les elements liberes
+//sont chaines dans une liste libre et reutilises avant d'entamer un nouveau bloc.
+//clear() rend tous les blocs d'un coup : les destructeurs des elements encore
+//vivants doivent avoir ete appeles avant (release ou destruction directe).
+template <class T> class KDPool
+{
+	//Nombre d'elements par bloc
+	static const size_t blocksize=4096;
+	
+	//Un emplacement contient soit un element, soit le lien vers l'emplacement libre suivant
+	union Slot
+	{
+		char data[sizeof(T)];
+		Slot* next;
+		//Pour l'alignement
+		double d;
+		void* p;
+	};
+	
+	vector<Slot*> blocks;
+	Slot* freelist;
+	size_t used;//emplacements utilises dans le dernier bloc
+	
+	//Non copiable
+	KDPool(const KDPool&);
+	KDPool& operator = (const KDPool&);
+	
+	public:
+	
+	KDPool() : freelist(NULL), used(blocksize) {}
+	~KDPool() {clear();}
+	
+	//Emplacement non initialise pour un element, a construire avec un new place
+	void* allocate(void)
+	{
+		if (freelist!=NULL)
+		{
+			Slot* s=freelist;
+			freelist=s->next;
+			return s;
+		}
+		if (used==blocksize)
+		{
+			blocks.push_back(static_cast<Slot*>(malloc(blocksize*sizeof(Slot))));
+			if (blocks.back()==NULL) {blocks.pop_back(); throw bad_alloc();}
+			used=0;
+		}
+		return blocks.back()+used++;
+	}
+	
+	//Detruit un element et rend son emplacement
+	void release(T* elt)
+	{
+		elt->~T();
+		Slot* s=reinterpret_cast<Slot*>(elt);
+		s->next=freelist;
+		freelist=s;
+	}
+	
+	//Rend tous les blocs
+	void clear(void)
+	{
+		for (size_t i=0;i<blocks.size();i++) free(blocks[i]);
+		blocks.clear();
+		freelist=NULL;
+		used=blocksize;
+	}
+	
+	//Memoire reellement reservee
+	size_t allocated(void) const { return blocks.size()*blocksize*sizeof(Slot); }
+	//Memoire totale du pool, index des blocs compris
+	size_t footprint(void) const { return sizeof(*this)+blocks.capacity()*sizeof(Slot*)+allocated(); }
+	//Emplacements reserves mais inoccupes (parcourt la liste libre)
+	size_t available(void) const
+	{
+		size_t nb=blocks.empty() ? 0 : blocksize-used;
+		for (const Slot* s=freelist;s!=NULL;s=s->next) nb++;
+		return nb;
+	}
+};
+
+#endif /* !KDPOOL_HH */
@@ -0,0 +1,154 @@
+template <class Object, int Dim, class Coord>
+KDSharedTree<Object,Dim,Coord>::KDSharedTree(int maxReaders,size_t b) : epoch(1), nbslots(maxReaders), bucket(b), pending(0)
+{
+	if (nbslots<1) nbslots=1;
+	slots=new Slot[nbslots];
+	for (int i=0;i<nbslots;i++) {slots[i].epoch=0;slots[i].used=0;}
+	//Insertions auto-equilibrees : le redacteur n'a jamais a reequilibrer son arbre
+	master.setAlpha(0.7);
+	current=new Frozen();
+	pthread_mutex_init(&writer,NULL);
+}
+
+template <class Object, int Dim, class Coord>
+KDSharedTree<Object,Dim,Coord>::~KDSharedTree()
+{
+	for (size_t i=0;i<retired.size();i++) delete retired[i].version;
+	delete current;
+	delete [] slots;
+	pthread_mutex_destroy(&writer);
+}
+
+template <class Object, int Dim, class Coord>
+int KDSharedTree<Object,Dim,Coord>::attach(void) const
+{
+	for (int i=0;i<nbslots;i++)
+		if (__sync_bool_compare_and_swap(&slots[i].used,0,2))
+		{
+			//Pris (2) avant d'etre attribue (1) : owns ne lit owner qu'une fois ecrit
+			slots[i].owner=pthread_self();
+			__sync_synchronize();
+			slots[i].used=1;
+			return i;
+		}
+	return -1;
+}
+
+template <class Object, int Dim, class Coord>
+bool KDSharedTree<Object,Dim,Coord>::owns(int slot) const
+{
+	return slot>=0 && slot<nbslots && slots[slot].used==1 && pthread_equal(slots[slot].owner,pthread_self());
+}
+
+template <class Object, int Dim, class Coord>
+void KDSharedTree<Object,Dim,Coord>::detach(int slot) const
+{
+	if (!owns(slot)) return;
+	slots[slot].epoch=0;
+	__sync_synchronize();
+	slots[slot].used=0;
+}
+
+//Le lecteur annonce son epoque avant de lire la version courante (barriere entre les deux) :
+//le redacteur remplace la version avant de changer d'epoque et de regarder les lecteurs.
+//Un lecteur qu'il voit hors lecture lira donc forcement la nouvelle version.
+template <class Object, int Dim, class Coord>
+const typename KDSharedTree<Object,Dim,Coord>::Frozen* KDSharedTree<Object,Dim,Coord>::enter(int slot) const
+{
+	if (!owns(slot)) return &none;
+	slots[slot].epoch=epoch;
+	__sync_synchronize();
+	return current;
+}
+
+template <class Object, int Dim, class Coord>
+void KDSharedTree<Object,Dim,Coord>::leave(int slot) const
+{
+	if (!owns(slot)) return;
+	__sync_synchronize();
+	slots[slot].epoch=0;
+}
+
+template <class Object, int Dim, class Coord>
+bool KDSharedTree<Object,Dim,Coord>::insert(const KDObj& data)
+{
+	pthread_mutex_lock(&writer);
+	bool res=master.insert(data);
+	if (res) pending++;
+	pthread_mutex_unlock(&writer);
+	return res;
+}
+
+template <class Object, int Dim, class Coord>
+bool KDSharedTree<Object,Dim,Coord>::remove(const Coord* point,const Object& obj)
+{
+	pthread_mutex_lock(&writer);
+	bool res=master.remove(point,obj);
+	if (res) pending++;
+	pthread_mutex_unlock(&writer);
+	return res;
+}
+
+template <class Object, int Dim, class Coord>
+bool KDSharedTree<Object,Dim,Coord>::publish(void)
+{
+	pthread_mutex_lock(&writer);
+	bool res=(pending>0);
+	if (res)
+	{
+		//La nouvelle version est construite a l'ecart, puis mise en place d'un coup
+		const Frozen* version=new Frozen(master,bucket);
+		const Frozen* old=current;
+		__sync_synchronize();
+		current=version;
+		__sync_synchronize();
+		Retired r;
+		r.version=old;
+		r.epoch=__sync_add_and_fetch(&epoch,1);
+		retired.push_back(r);
+		pending=0;
+	}
+	reclaim();
+	pthread_mutex_unlock(&writer);
+	return res;
+}
+
+template <class Object, int Dim, class Coord>
+void KDSharedTree<Object,Dim,Coord>::reclaim(void)
+{
+	//Plus ancienne epoque des lectures en cours
+	long oldest=numeric_limits<long>::max();
+	for (int i=0;i<nbslots;i++)
+	{
+		long e=slots[i].epoch;
+		if (e!=0 && e<oldest) oldest=e;
+	}
+	size_t kept=0;
+	for (size_t i=0;i<retired.size();i++)
+	{
+		if (retired[i].epoch<=oldest) delete retired[i].version;
+		else retired[kept++]=retired[i];
+	}
+	retired.resize(kept);
+}
+
+template <class Object, int Dim, class Coord>
+typename KDSharedTree<Object,Dim,Coord>::KDRes KDSharedTree<Object,Dim,Coord>::findNN(int slot,const Coord* point) const
+{
+	Snapshot s(*this,slot);
+	return s.tree().findNN(point);
+}
+
+template <class Object, int Dim, class Coord>
+vector<typename KDSharedTree<Object,Dim,Coord>::KDRes> KDSharedTree<Object,Dim,Coord>::findNear(int slot,const Coord* point,const Dist radius) const
+{
+	Snapshot s(*this,slot);
+	return s.tree().findNear(point,radius);
+}
+
+template <class Object, int Dim, class Coord>
+long KDSharedTree<Object,Dim,Coord>::count(int slot) const
+{
+	Snapshot s(*this,slot);
+	return s.tree().count();
+}
@@ -0,0 +1,121 @@
+#ifndef KDSHAREDTREE_HH
+#define KDSHAREDTREE_HH 1
+
+#include "KDFrozenTree.hh"
+#include <pthread.h>
+
+//KDTree partage entre un redacteur et des lecteurs concurrents (facon RCU)
+//Le redacteur modifie sa propre copie de l'arbre (insert, remove), puis publie d'un coup
+//une nouvelle version figee : les lecteurs cherchent dans la derniere version publiee,
+//sans verrou, et ne voient jamais une modification a moitie faite.
+//Chaque version remplacee est liberee quand plus aucun lecteur ne peut la tenir :
+//un lecteur note l'epoque courante en entrant dans une lecture, une version retiree
+//a l'epoque e attend que tous les lecteurs en cours soient entres a l'epoque e ou apres.
+//Les noeuds d'un KDTree appartiennent a son pool et ne peuvent pas etre partages entre
+//versions : il n'y a pas de copie de chemin, chaque publication reconstruit une copie figee
+//complete en O(n log n). Son cout croit avec la taille de l'arbre et non avec celle du lot
+//(voir la mesure "publish" de kdtree-bench) : il vaut donc mieux publier de gros lots.
+template <class Object, int Dim=DIMENSIONS, class Coord=float> class KDSharedTree
+{
+	public:
+	typedef KDTree<Object,Dim,Coord> Tree;
+	typedef KDFrozenTree<Object,Dim,Coord> Frozen;
+	typedef typename Tree::KDObj KDObj;
+	typedef typename Tree::KDRes KDRes;
+	typedef typename Tree::Dist Dist;
+
+	private:
+	//Emplacement d'un thread lecteur, seul sur sa ligne de cache
+	struct Slot
+	{
+		volatile long epoch;//epoque a l'entree dans la lecture en cours, 0 hors lecture
+		volatile long used;//emplacement attribue a un thread (1), en cours d'attribution (2), libre (0)
+		pthread_t owner;//ce thread, valable quand used vaut 1
+		char pad[64-2*sizeof(long)-sizeof(pthread_t)];
+	};
+	//Version remplacee, a liberer quand tous les lecteurs en cours sont entres a epoch ou apres
+	struct Retired
+	{
+		const Frozen* version;
+		long epoch;
+	};
+
+	//Arbre du redacteur, et derniere version publiee
+	Tree master;
+	const Frozen* volatile current;
+	volatile long epoch;
+	Slot* slots;
+	int nbslots;
+	vector<Retired> retired;
+	size_t bucket;
+	//Modifications pas encore publiees
+	long pending;
+	//Un seul redacteur a la fois
+	pthread_mutex_t writer;
+	//Version vide, lue a la place de la courante avec un emplacement invalide (attach rate)
+	const Frozen none;
+
+	//Non copiable
+	KDSharedTree(const KDSharedTree&);
+	KDSharedTree& operator = (const KDSharedTree&);
+
+	//Vrai si slot a ete attribue par attach au thread appelant
+	bool owns(int slot) const;
+	//Entree et sortie d'une lecture par le lecteur slot (sans effet si le thread appelant ne le tient pas)
+	const Frozen* enter(int slot) const;
+	void leave(int slot) const;
+	//Libere les versions retirees que plus aucun lecteur ne tient
+	void reclaim(void);
+
+	public:
+
+	//Lecture de la derniere version publiee, tenue jusqu'a la destruction de l'objet
+	//Le meme lecteur (slot) ne doit pas tenir deux lectures a la fois
+	class Snapshot
+	{
+		const KDSharedTree& shared;
+		int slot;
+		const Frozen* version;
+		//Non copiable
+		Snapshot(const Snapshot&);
+		Snapshot& operator = (const Snapshot&);
+		public:
+		Snapshot(const KDSharedTree& s,int r) : shared(s), slot(r), version(s.enter(r)) {}
+		~Snapshot() {shared.leave(slot);}
+		const Frozen& tree(void) const {return *version;}
+		//Faux si slot n'a pas ete attribue au thread appelant : tree() est alors un arbre vide
+		bool valid(void) const {return version!=&shared.none;}
+	};
+	friend class Snapshot;
+
+	//maxReaders : nombre maximal de threads lecteurs attaches en meme temps
+	//bucket : taille des feuilles des versions figees
+	KDSharedTree(int maxReaders=64,size_t bucket=16);
+	~KDSharedTree();
+
+	//Attribue un emplacement au thread lecteur appelant (-1 si tous sont pris), a rendre par detach
+	//Les lectures avec -1, ou tout emplacement qui n'a pas ete attribue au thread appelant, ne
+	//voient qu'un arbre vide ; detach est alors sans effet
+	int attach(void) const;
+	void detach(int slot) const;
+
+	//Redacteur : les modifications ne sont visibles des lecteurs qu'apres publish
+	bool insert(const KDObj& data);
+	bool remove(const Coord* point,const Object& obj);
+	//Publie l'etat courant de l'arbre du redacteur (reconstruction complete, meme pour une
+	//seule modification), renvoie false s'il n'y avait rien a publier
+	bool publish(void);
+	long unpublished(void) const {return pending;}
+	//Versions en memoire, la courante comprise (cote redacteur)
+	size_t versions(void) const {return retired.size()+1;}
+
+	//Lecteurs : une requete sur la derniere version publiee (vide si le thread ne tient pas slot)
+	KDRes findNN(int slot,const Coord* point) const;
+	vector<KDRes> findNear(int slot,const Coord* point,const Dist radius) const;
+	long count(int slot) const;
+};
+
+//Because of the template class, implementation must be here :(
+#include "KDSharedTree.cc"
+
+#endif /* !KDSHAREDTREE_HH */
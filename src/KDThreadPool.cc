@@ -0,0 +1,153 @@
+#include <unistd.h>
+
+inline KDThreadPool::KDThreadPool(int nbthreads) : queued(0), pending(0), stop(false)
+{
+	if (nbthreads<=0) nbthreads=sysconf(_SC_NPROCESSORS_ONLN);
+	if (nbthreads<=0) nbthreads=1;
+	pthread_mutex_init(&lock,NULL);
+	pthread_mutex_init(&runlock,NULL);
+	pthread_cond_init(&workcond,NULL);
+	pthread_cond_init(&donecond,NULL);
+	for (int i=0;i<nbthreads;i++)
+	{
+		Worker* w=new Worker;
+		w->pool=this;
+		w->id=i;
+		pthread_mutex_init(&w->lock,NULL);
+		workers.push_back(w);
+	}
+	//Les threads ne demarrent qu'une fois toutes les files creees
+	for (int i=0;i<nbthreads;i++)
+		pthread_create(&workers[i]->thread,NULL,start,workers[i]);
+}
+
+inline KDThreadPool::~KDThreadPool()
+{
+	pthread_mutex_lock(&lock);
+	stop=true;
+	pthread_cond_broadcast(&workcond);
+	pthread_mutex_unlock(&lock);
+	for (size_t i=0;i<workers.size();i++)
+	{
+		pthread_join(workers[i]->thread,NULL);
+		pthread_mutex_destroy(&workers[i]->lock);
+		delete workers[i];
+	}
+	pthread_cond_destroy(&donecond);
+	pthread_cond_destroy(&workcond);
+	pthread_mutex_destroy(&runlock);
+	pthread_mutex_destroy(&lock);
+}
+
+inline void KDThreadPool::spawn(Task* task,int worker)
+{
+	//La tache est comptee avant d'etre visible : un autre thread peut la voler et la finir
+	//aussitot, pending ne doit pas tomber a 0 tant que la tache qui l'a creee tourne
+	pthread_mutex_lock(&lock);
+	queued++;
+	pending++;
+	pthread_mutex_unlock(&lock);
+	
+	Worker* w=workers[worker];
+	pthread_mutex_lock(&w->lock);
+	w->tasks.push_back(task);
+	pthread_mutex_unlock(&w->lock);
+	
+	pthread_mutex_lock(&lock);
+	pthread_cond_signal(&workcond);
+	pthread_mutex_unlock(&lock);
+}
+
+inline void KDThreadPool::run(Task* task)
+{
+	pthread_mutex_lock(&runlock);
+	spawn(task,0);
+	pthread_mutex_lock(&lock);
+	while (pending>0) pthread_cond_wait(&donecond,&lock);
+	pthread_mutex_unlock(&lock);
+	pthread_mutex_unlock(&runlock);
+}
+
+inline void KDThreadPool::parallelFor(size_t first,size_t last,size_t grain,Body& body)
+{
+	if (first>=last) return;
+	if (grain==0) grain=1;
+	run(new RangeTask(body,first,last,grain));
+}
+
+inline void KDThreadPool::RangeTask::run(KDThreadPool& pool,int worker)
+{
+	//On garde la premiere moitie et on propose la seconde aux autres threads
+	while (last-first>grain)
+	{
+		size_t mid=first+(last-first)/2;
+		pool.spawn(new RangeTask(body,mid,last,grain),worker);
+		last=mid;
+	}
+	body(first,last,worker);
+}
+
+//Prend la derniere tache de sa file, ou vole la premiere d'une autre file
+inline KDThreadPool::Task* KDThreadPool::take(int worker)
+{
+	Task* task=NULL;
+	Worker* w=workers[worker];
+	pthread_mutex_lock(&w->lock);
+	if (!w->tasks.empty())
+	{
+		task=w->tasks.back();
+		w->tasks.pop_back();
+	}
+	pthread_mutex_unlock(&w->lock);
+	
+	for (size_t i=1;task==NULL && i<workers.size();i++)
+	{
+		Worker* victim=workers[(worker+i)%workers.size()];
+		pthread_mutex_lock(&victim->lock);
+		if (!victim->tasks.empty())
+		{
+			task=victim->tasks.front();
+			victim->tasks.pop_front();
+		}
+		pthread_mutex_unlock(&victim->lock);
+	}
+	return task;
+}
+
+inline void KDThreadPool::loop(int worker)
+{
+	while(true)
+	{
+		Task* task=take(worker);
+		if (task!=NULL)
+		{
+			pthread_mutex_lock(&lock);
+			queued--;
+			pthread_mutex_unlock(&lock);
+			
+			task->run(*this,worker);
+			delete task;
+			
+			pthread_mutex_lock(&lock);
+			pending--;
+			if (pending==0) pthread_cond_broadcast(&donecond);
+			pthread_mutex_unlock(&lock);
+		}
+		else
+		{
+			//Rien a prendre : on attend qu'une tache soit ajoutee
+			pthread_mutex_lock(&lock);
+			while (queued==0 && !stop) pthread_cond_wait(&workcond,&lock);
+			bool quit=stop && queued==0;
+			pthread_mutex_unlock(&lock);
+			if (quit) return;
+		}
+	}
+}
+
+inline void* KDThreadPool::start(void* worker)
+{
+	Worker* w=static_cast<Worker*>(worker);
+	w->pool->loop(w->id);
+	return NULL;
+}
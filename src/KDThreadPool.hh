@@ -0,0 +1,89 @@
+#ifndef KDTHREADPOOL_HH
+#define KDTHREADPOOL_HH 1
+
+#include <vector>
+#include <deque>
+#include <pthread.h>
+using namespace std;
+
+//Groupe de threads pour les traitements paralleles des KDTree
+//Chaque thread a sa propre file de taches : il prend les plus recentes de la sienne,
+//et quand elle est vide il vole les plus anciennes (les plus grosses) des autres.
+//Un seul traitement (run / parallelFor) a la fois, les appels concurrents attendent leur tour.
+class KDThreadPool
+{
+	public:
+	
+	//Tache executee par un thread du groupe, detruite apres execution
+	class Task
+	{
+		public:
+		virtual ~Task() {}
+		virtual void run(KDThreadPool& pool,int worker)=0;
+	};
+	
+	//Corps d'une boucle parallele, appele sur des intervalles [first,last) disjoints
+	class Body
+	{
+		public:
+		virtual ~Body() {}
+		virtual void operator () (size_t first,size_t last,int worker)=0;
+	};
+	
+	//nbthreads<=0 : autant de threads que de processeurs
+	KDThreadPool(int nbthreads=0);
+	~KDThreadPool();
+	
+	//Nombre de threads, les numeros des threads (worker) vont de 0 a size()-1
+	int size(void) const { return workers.size(); }
+	
+	//Lance une tache et attend la fin de toutes celles qu'elle a engendrees
+	void run(Task* task);
+	//Ajoute une tache, a appeler depuis une tache en cours sur le thread worker
+	void spawn(Task* task,int worker);
+	//Applique body sur [first,last), decoupe en intervalles d'au moins grain elements
+	void parallelFor(size_t first,size_t last,size_t grain,Body& body);
+	
+	private:
+	
+	struct Worker
+	{
+		KDThreadPool* pool;
+		int id;
+		pthread_t thread;
+		pthread_mutex_t lock;
+		deque<Task*> tasks;
+	};
+	
+	//Tache de decoupe d'une boucle parallele
+	class RangeTask : public Task
+	{
+		Body& body;
+		size_t first,last,grain;
+		public:
+		RangeTask(Body& b,size_t f,size_t l,size_t g) : body(b), first(f), last(l), grain(g) {}
+		void run(KDThreadPool& pool,int worker);
+	};
+	
+	vector<Worker*> workers;
+	pthread_mutex_t lock;//protege les compteurs et l'arret
+	pthread_cond_t workcond;//des taches sont disponibles
+	pthread_cond_t donecond;//toutes les taches sont finies
+	pthread_mutex_t runlock;//un seul traitement a la fois
+	size_t queued;//taches en attente dans les files
+	size_t pending;//taches pas encore terminees
+	bool stop;
+	
+	//Non copiable
+	KDThreadPool(const KDThreadPool&);
+	KDThreadPool& operator = (const KDThreadPool&);
+	
+	Task* take(int worker);
+	void loop(int worker);
+	static void* start(void* worker);
+};
+
+//Implementation en ligne, pour rester utilisable sans bibliotheque
+#include "KDThreadPool.cc"
+
+#endif /* !KDTHREADPOOL_HH */
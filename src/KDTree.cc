@@ -1,464 +1,966 @@
-template <class Object>
+//Insere un noeud seul : on descend jusqu'a une place libre,
+//chaque noeud traverse compte un descendant de plus
+template <class Object, int Dim, class Coord>
 bool
-KDTree<Object>::insert(KDNode* start, short dimstart, KDNode* node)
+KDTree<Object,Dim,Coord>::insert(KDNode* start, short dimstart, KDNode* node)
 {
-	//On detache le noeud a inserer si il etait attache
-	node->parent=NULL;
+	node->left=NULL;
+	node->right=NULL;
+	if (start==NULL)
+	{
+		root=node;
+		return true;
+	}
 	
-	//On parcours l'arbre a inserer
-	KDNode* tnode=node;
-	bool goup=false;//pour signaler de remonter
-	do
+	short dim=dimstart;
+	KDNode* temp=start;
+	vector<KDNode*> path;
+	while(true)
 	{
-		if ( tnode->left!=NULL && !goup )
-		{
-			node=tnode;tnode=tnode->left;goup=false;
-		}
-		else if ( (tnode->right!=NULL) && (!goup || node==tnode->left) )
-		{
-			node=tnode;tnode=tnode->right;goup=false;
-		}
-		else //Dans les autres cas on remonte
+		temp->size++;
+#ifdef BBOX
+		KDUnroll<Dim>::minmax(node->data().coords,temp->lo,temp->hi);
+#endif
+		if (alpha>0.0) path.push_back(temp);
+		KDNode*& son=(node->data()[dim]<=temp->data()[dim]) ? temp->left : temp->right;
+		if (son==NULL)
 		{
-			node=tnode;tnode=tnode->parent;goup=true;
+			son=node;
+			break;
 		}
-		
-		if(goup)//Quand on remonte
+		temp=son;
+		dim=next(dim);
+	}
+#ifndef REC
+	node->parent=temp;
+#endif
+	
+	//Mode auto-equilibre (bouc emissaire) : si le nouveau noeud est trop profond, on reconstruit
+	//le plus petit de ses ancetres dont un fils pese plus de alpha fois son poids
+	if (alpha>0.0 && path.size()>log(static_cast<double>(start->size))/-log(alpha))
+	{
+		for (size_t i=path.size();i>0;i--)
 		{
-			//On insere l'ancien noeud dans l'arbre
-			short dim=dimstart;
-			unsigned char curson=' ';
-			KDNode* prev=start;
-			KDNode* temp=prev;
-			while (temp!=NULL)
+			const KDNode* up=path[i-1];
+			long l=(up->left==NULL) ? 0 : up->left->size;
+			long r=(up->right==NULL) ? 0 : up->right->size;
+			if (l>alpha*up->size || r>alpha*up->size)
 			{
-				prev=temp;
-				if (node->data()[dim]<=prev->data()[dim])
-				{
-					temp=temp->left;curson='l';
-				}
-				else
-				{
-					temp=temp->right;curson='r';
-				}
-				dim=(dim+1) % dimensions;
+				rebuild(path,i-1);
+				break;
 			}
-			
-			if (temp!=root)
-			{
-				switch(curson)
-				{
-					case 'l' : prev->left=node;break;
-					case 'r' : prev->right=node;break;
-					default : cerr << "ERROR in Insert" << endl; return false;
-				}
-				node->parent=prev;
-			}
-			else// prev==temp==null==root => en root
-				root=node;
-			//On detache le noeud de son ancien arbre
-			node->left=NULL;
-			node->right=NULL;
 		}
-	}while (tnode!=NULL);
-	if(!goup) {cerr << "ERROR in Insert Loop" << endl; exit(-1);}
-	//On est sorti de la boucle en remontant l'arbre
-	
+	}
 	return true;
 }
-template <class Object>
+//Boite englobante des objets d'un sous arbre, parcouru avec une pile : l'arbre n'est pas modifie
+template <class Object, int Dim, class Coord>
 bool
-KDTree<Object>::minmax(KDNode* start, short dimstart, float* min,float* max)
+KDTree<Object,Dim,Coord>::minmax(const KDNode* start, Coord* min,Coord* max) const
 {
-	short dim=dimstart;
-	//On detache le noeud de depart
-	KDNode* pmem=start->parent;
-	start->parent=NULL;
+	KDStack<const KDNode*> todo;
+	todo.push(start);
+	while(!todo.empty())
+	{
+		const KDNode* temp=todo.pop();
+		if (!temp->removed) KDUnroll<Dim>::minmax(temp->data().coords,min,max);
+		if (temp->left!=NULL) todo.push(temp->left);
+		if (temp->right!=NULL) todo.push(temp->right);
+	}
+	return true;
+}
+
+//Les recherches ne modifient pas l'arbre : les sous arbres restant a visiter
+//sont gardes sur une pile, plusieurs threads peuvent donc chercher en meme temps
+//Recherche approchee : un sous arbre est elague des que sa distance minimale depasse
+//dist/(1+epsilon), et la recherche s'arrete apres maxVisits noeuds (0 : sans limite)
+template <class Object, int Dim, class Coord>
+bool
+KDTree<Object,Dim,Coord>::findNN(const KDNode* start,short dimstart,const Coord* point,const KDNode*& neighbor, Dist& dist,const Dist epsilon,size_t maxVisits) const
+{
+	//On travaille sur les distances au carre
+	Dist best=(neighbor==NULL) ? numeric_limits<Dist>::max() : dist*dist;
+	const Dist factor=(1+epsilon)*(1+epsilon);
+	size_t visits=0;
+	KDSTAT(KDQueryStats qs);
 	
-	//ALGO A OPTIMISER
-	KDNode* temp=start;
-	bool goup=false;//pour signaler de remonter
-	while(temp!=NULL)
+	KDStack<KDVisit> todo;
+	KDVisit v;
+	v.node=start;v.dim=dimstart;v.bound=0;
+	todo.push(v);
+	while(!todo.empty() && (maxVisits==0 || visits<maxVisits))
 	{
-		if(!goup)
+		v=todo.pop();
+		if (v.bound*factor>best)
 		{
-			//On fait les test min / max
-			for (short i=0;i<dimensions;i++)
-			{
-				if (start->data()[i]<min[i]) min[i]=start->data()[i];
-				if (start->data()[i]>max[i]) max[i]=start->data()[i];
-			}
+			KDSTAT(qs.pruned++);
+			continue;
 		}
 		
-		if ( temp->left!=NULL && !goup )
-		{
-			start=temp;temp=temp->left;goup=false;dim=(dim+1)%dimensions;
-		}
-		else if ( (temp->right!=NULL) && (!goup || start==temp->left) )
-		{
-			start=temp;temp=temp->right;goup=false;dim=(dim+1)%dimensions;
-		}
-		else //Dans les autres cas on remonte
+		//On descend du cote du point, en memorisant l'autre cote
+		const KDNode* temp=v.node;
+		short dim=v.dim;
+		while(temp!=NULL && (maxVisits==0 || visits<maxVisits))
 		{
-			start=temp;temp=temp->parent;goup=true;dim=(dim-1)%dimensions;
+			visits++;
+			KDSTAT(qs.visited++;qs.distances++);
+			Dist sum=temp->data().sqdist(point);
+			if (!temp->removed && (sum<best || neighbor==NULL))
+			{
+				KDSTAT(qs.hits++);
+				best=sum;
+				neighbor=temp;
+			}
+			Dist diff=static_cast<Dist>(point[dim])-static_cast<Dist>(temp->data()[dim]);
+			const KDNode* further=(diff<=0)?temp->right:temp->left;
+#ifdef BBOX
+			//La boite du sous arbre est dans sa cellule : elle elague mieux que le plan de coupe
+			Dist bound=(further!=NULL) ? boxNear(further,point) : 0;
+#else
+			Dist bound=diff*diff;
+#endif
+			if (further!=NULL && bound*factor<=best)
+			{
+				KDVisit f;
+				f.node=further;f.dim=next(dim);f.bound=bound;
+				todo.push(f);
+				KDSTAT(qs.stack(todo.size()));
+			}
+			KDSTAT(else if (further!=NULL) qs.pruned++);
+			temp=(diff<=0)?temp->left:temp->right;
+			dim=next(dim);
 		}
-
 	}
-	if(!goup) {cerr << "ERROR in MinMax" << endl; exit(-1);}
-	//On est sorti de la boucle en remontant l'arbre
-	//On rattache le noeud de depart
-	start->parent=pmem;
-	return true;
+	KDSTAT(record(qs));
+	if (neighbor!=NULL) dist=sqrt(best);
+	return neighbor!=NULL;
 }
 
-template <class Object>
-bool
-KDTree<Object>::findNN(KDNode* start,short dimstart,const float* point,const KDNode*& neighbor, float& dist)
+//Les distances sont comparees au carre : pas de racine carree par noeud visite
+//visit(const KDObj&,Dist) recoit chaque objet retenu avec sa distance au carre
+template <class Object, int Dim, class Coord>
+template <class Visitor>
+void
+KDTree<Object,Dim,Coord>::findNear(const KDNode* start,short dimstart,const Coord* point, const Dist radius,Visitor& visit) const
 {
-	int dim=dimstart;
-	//On detache le noeud de depart
-	KDNode* pmem=start->parent;
-	start->parent=NULL;
-	
-	KDNode* temp=start;
-	bool goup=false;//pour signaler de remonter
-	while(temp!=NULL)
+	const Dist sqradius=radius*radius;
+	KDSTAT(KDQueryStats qs);
+	KDStack<KDVisit> todo;
+	KDVisit v;
+	v.node=start;v.dim=dimstart;v.bound=0;
+	todo.push(v);
+	while(!todo.empty())
 	{
-		if(!goup)
+		v=todo.pop();
+		const KDNode* temp=v.node;
+		short dim=v.dim;
+		while(temp!=NULL)
 		{
 			//On fait les test de distance
-			float sum=start->data().dist(point);
-			if (sum <dist || neighbor==NULL) 
+			KDSTAT(qs.visited++;qs.distances++);
+			Dist sum=temp->data().sqdist(point);
+			if (sum <=sqradius && !temp->removed)
 			{
-				dist=sum;
-				neighbor=start;
+				KDSTAT(qs.hits++);
+				visit(temp->data(),sum);
 			}
-		}
-					
-		if ( temp->left!=NULL && !goup && (dist>=0 && point[dimstart]-dist<= temp->data()[dimstart] ))
-		{
-			start=temp;temp=temp->left;goup=false;dim=(dim+1)%dimensions;
-		}
-		else if ( (temp->right!=NULL) && (!goup || start==temp->left)  && (dist>=0 && point[dimstart]+dist> start->data()[dimstart] ))
-		{
-			start=temp;temp=temp->right;goup=false;dim=(dim+1)%dimensions;
-		}
-		else //Dans les autres cas on remonte
-		{
-			start=temp;temp=temp->parent;goup=true;dim=(dim-1)%dimensions;
+			
+			//L'autre cote n'est visite que si le plan de coupe est dans le rayon
+			Dist diff=static_cast<Dist>(point[dim])-static_cast<Dist>(temp->data()[dim]);
+			const KDNode* further=(diff<=0)?temp->right:temp->left;
+			if (further!=NULL && diff*diff<=sqradius)
+			{
+				KDVisit f;
+				f.node=further;f.dim=next(dim);f.bound=0;
+				todo.push(f);
+				KDSTAT(qs.stack(todo.size()));
+			}
+			KDSTAT(else if (further!=NULL) qs.pruned++);
+			temp=(diff<=0)?temp->left:temp->right;
+			dim=next(dim);
 		}
 	}
-	if(!goup) {cerr << "ERROR in findNN" << endl; exit(-1);}
-	//On est sorti de la boucle en remontant l'arbre
-	//On rattache le noeud de depart
-	start->parent=pmem;
-	return true;
+	KDSTAT(record(qs));
 }
 
-template <class Object>
-bool
-KDTree<Object>::findNear(KDNode* start,short dimstart,const float* point, const float radius,vector<const KDNode*>& neighbor, vector<float>& dist)
+//Recherche dans une boite : on suit la cellule de chaque sous arbre,
+//un sous arbre dont la cellule est dans la boite est rapporte en entier sans tests
+template <class Object, int Dim, class Coord>
+template <class Visitor>
+void KDTree<Object,Dim,Coord>::findInAABox(const KDNode* start,short dimstart,const Coord* min,const Coord* max,Visitor& visit) const
 {
-	short dim=dimstart;
-	//On detache le noeud de depart
-	KDNode* pmem=start->parent;
-	start->parent=NULL;
-	
-	KDNode* temp=start;
-	bool goup=false;//pour signaler de remonter
-	while(temp!=NULL)
+	KDSTAT(KDQueryStats qs);
+	KDStack<KDCell> todo;
+	KDStack<const KDNode*> inside;
+	KDCell c;
+	c.node=start;c.dim=dimstart;
+	for (short i=0;i<dimensions;i++) {c.lo[i]=KDLowest<Coord>();c.hi[i]=numeric_limits<Coord>::max();}
+	todo.push(c);
+	while(!todo.empty())
 	{
-		if (!goup)
+		c=todo.pop();
+		bool contained=true;
+		for (short i=0;i<dimensions && contained;i++) contained=(min[i]<=c.lo[i] && c.hi[i]<=max[i]);
+		if (contained)
 		{
-			//On fait les test de distance
-			float sum=temp->data().dist(point);
-			if (sum <=radius) 
+			//Tout le sous arbre est dans la boite
+			inside.push(c.node);
+			while(!inside.empty())
 			{
-				dist.push_back(sum);
-				neighbor.push_back(temp);
+				const KDNode* temp=inside.pop();
+				KDSTAT(qs.visited++;qs.hits+=!temp->removed);
+				if (!temp->removed) visit(temp->data());
+				if (temp->left!=NULL) inside.push(temp->left);
+				if (temp->right!=NULL) inside.push(temp->right);
 			}
+			continue;
 		}
-
-		//On choisit le prochain noeud a tester
-		if ( (temp->left!=NULL) && (!goup) && (point[dim]-radius<=temp->data()[dim]))
+		
+		const KDObj& data=c.node->data();
+		bool in=true;
+		KDSTAT(qs.visited++);
+		for (short i=0;i<dimensions && in;i++) in=(min[i]<=data[i] && data[i]<=max[i]);
+		if (in && !c.node->removed)
 		{
-			start=temp;temp=temp->left;goup=false;dim=(dim+1)%dimensions;
+			KDSTAT(qs.hits++);
+			visit(data);
 		}
-		else if ( (temp->right!=NULL) && (!goup || start==temp->left) && (point[dim]+radius>temp->data()[dim]) )
+		
+		//A gauche <= coupe <= a droite : on ne garde que les cotes qui touchent la boite
+		Coord split=data[c.dim];
+		KDCell sub=c;
+		sub.dim=next(c.dim);
+		if (c.node->right!=NULL && max[c.dim]>=split)
 		{
-			start=temp;temp=temp->right;goup=false;dim=(dim+1)%dimensions;
+			sub.node=c.node->right;
+			sub.lo[c.dim]=split;
+			todo.push(sub);
+			sub.lo[c.dim]=c.lo[c.dim];
 		}
-		else //Dans les autres cas on remonte
+		KDSTAT(else if (c.node->right!=NULL) qs.pruned++);
+		if (c.node->left!=NULL && min[c.dim]<=split)
 		{
-			start=temp;temp=temp->parent;goup=true;dim=(dim+dimensions-1)%dimensions;
+			sub.node=c.node->left;
+			sub.hi[c.dim]=split;
+			todo.push(sub);
 		}
+		KDSTAT(else if (c.node->left!=NULL) qs.pruned++);
+		KDSTAT(qs.stack(todo.size()));
 	}
-	if(!goup) {cerr << "ERROR in findNear" << endl; exit(-1);}
-	//On est sorti de la boucle en remontant l'arbre
-	//On rattache le noeud de depart
-	start->parent=pmem;
-	
-	return true;
+	KDSTAT(record(qs));
 }
 
-//Recupere le pivot dans un sous arbre
-//Pivot = +proche du milieu de l'hyperrectangle du sous arbre
-template <class Object>
-typename KDTree<Object>::KDNode* KDTree<Object>::pivot(const KDNode* start, short dimstart)
-{
-	float* min=new float[dimensions];
-	float* max=new float[dimensions];
-	//On cherche les dimensions de l'hyperrectangle du sous arbre
-	const KDNode* piv=start;
-	
-	minmax(const_cast<KDNode*>(start),dimstart,min,max);
-	//Calcul du centre de dimstart
-	float* mid=new float[dimensions];
-	for (short i=0;i<dimensions;i++) mid[i]=(min[i]+max[i]) / 2.0f;
-	
-	//On cherche le plus proche voisin
-	float dist;
-	findNN(const_cast<KDNode*>(start),dimstart,mid,piv,dist);
+//Reconstruit le sous arbre path[depth] par medianes, sans ses noeuds supprimes,
+//et le rattache a son pere path[depth-1] ; les ancetres perdent les noeuds supprimes
+//(compteurs et boites)
+template <class Object, int Dim, class Coord>
+void
+KDTree<Object,Dim,Coord>::rebuild(vector<KDNode*>& path, size_t depth)
+{
+	KDNode* start=path[depth];
+	long dead=start->dead;
+	vector<KDNode*> nodes;
+	collect(start,nodes,true);
+	KDNode* top=build(nodes,depth%dimensions);
+#ifdef BBOX
+	if (top!=NULL) bound(top);
+#endif
 	
-	return const_cast<KDNode*>(piv);
+	//On rattache le nouveau sous arbre
+	KDNode* pmem=(depth==0) ? NULL : path[depth-1];
+	if (pmem==NULL) root=top;
+	else if (pmem->left==start) pmem->left=top;
+	else pmem->right=top;
+#ifndef REC
+	if (top!=NULL) top->parent=pmem;
+#endif
+	for (size_t i=0;i<depth;i++)
+	{
+		path[i]->size-=dead;
+		path[i]->dead-=dead;
+	}
+#ifdef BBOX
+	//Les boites des ancetres ne contiennent plus les noeuds purges
+	for (size_t i=depth;i>0;i--) boundNode(path[i-1]);
+#endif
+	path[depth]=top;
 }
 
-template <class Object>
-bool
-KDTree<Object>::balance(KDNode* start, short dimstart)
+//Les noeuds connaissent la taille de leur sous arbre et le nombre de noeuds supprimes
+template <class Object, int Dim, class Coord>
+long
+KDTree<Object,Dim,Coord>::count(const KDNode* start) const
 {
-	short dim=dimstart;
-	//On detache le noeud de depart
-	KDNode* pmem=start->parent;
-	start->parent=NULL;
-	
-	KDNode* temp=start;
-	bool goup=false;//pour signaler de remonter
-	while(temp!=NULL)
+	return start->size-start->dead;
+}
+
+
+//Recupere tous les noeuds d'un sous arbre (parcours avec pile explicite)
+//purge : les noeuds supprimes sont detruits au lieu d'etre recuperes
+template <class Object, int Dim, class Coord>
+void KDTree<Object,Dim,Coord>::collect(KDNode* start,vector<KDNode*>& nodes,bool purge)
+{
+	vector<KDNode*> todo;
+	todo.push_back(start);
+	while(!todo.empty())
+	{
+		KDNode* temp=todo.back();todo.pop_back();
+		if (temp->left!=NULL) todo.push_back(temp->left);
+		if (temp->right!=NULL) todo.push_back(temp->right);
+		if (purge && temp->removed) pool.release(temp);
+		else nodes.push_back(temp);
+	}
+}
+
+#ifdef BBOX
+//Recalcule les boites d'un sous arbre, des feuilles vers la racine
+template <class Object, int Dim, class Coord>
+void KDTree<Object,Dim,Coord>::bound(KDNode* start)
+{
+	vector<KDNode*> nodes;
+	collect(start,nodes);
+	//collect range les peres avant leurs fils
+	for (size_t i=nodes.size();i>0;i--) boundNode(nodes[i-1]);
+}
+#endif
+
+//Construit un sous arbre equilibre a partir d'un ensemble de noeuds
+template <class Object, int Dim, class Coord>
+typename KDTree<Object,Dim,Coord>::KDNode* KDTree<Object,Dim,Coord>::build(vector<KDNode*>& nodes,short dimstart)
+{
+	KDBuildRange r;
+	r.first=0;r.last=nodes.size();r.parent=NULL;r.left=true;r.dim=dimstart;
+	if (r.last>r.first) return build(nodes,r,NULL,0);
+	else return NULL;
+}
+
+//Place les noeuds de l'intervalle range, et renvoie la racine de son sous arbre
+//Chaque niveau est coupe a la mediane (nth_element) : O(n log n) au total
+//Les noeuds sont reutilises tels quels, seuls leurs liens sont refaits
+//Avec un groupe de threads, les sous intervalles d'au moins buildGrain noeuds deviennent
+//des taches : ils sont disjoints, le resultat ne depend pas de l'ordre d'execution
+template <class Object, int Dim, class Coord>
+typename KDTree<Object,Dim,Coord>::KDNode* KDTree<Object,Dim,Coord>::build(vector<KDNode*>& nodes,const KDBuildRange& range,KDThreadPool* threads,int worker)
+{
+	KDNode* top=NULL;
+	vector<KDBuildRange> todo;
+	todo.push_back(range);
+	while(!todo.empty())
 	{
-		if(!goup)
+		KDBuildRange r=todo.back();todo.pop_back();
+		//La mediane devient le noeud courant : a gauche <= , a droite >=
+		size_t mid=r.first+(r.last-r.first)/2;
+		nth_element(nodes.begin()+r.first,nodes.begin()+mid,nodes.begin()+r.last,KDNodeCompare(r.dim));
+		KDNode* node=nodes[mid];
+		node->left=NULL;
+		node->right=NULL;
+		node->size=r.last-r.first;
+		node->dead=0;
+#ifndef REC
+		node->parent=r.parent;
+#endif
+		if (top==NULL) top=node;
+		if (r.parent!=NULL)
 		{
-			//On recupere le pivot
-			KDNode* piv=pivot(temp,dim);
-			
-			if (piv!=temp)
-			{
-				//On sauvegarde les sous-arbres de piv
-				KDNode* memleft=piv->left;
-				KDNode* memright=piv->right;
-			
-				//On detache piv
-				if(piv->parent!=NULL)
-				{
-					if (piv->parent->left==piv) piv->parent->left=NULL;
-					else if (piv->parent->right==piv) piv->parent->right=NULL;
-				}
-			
-				//piv prend la place du noeud courant
-				piv->left=NULL;
-				piv->right=NULL;
-				piv->parent=temp->parent;
-				if (piv->parent!=NULL)
-				{
-					if (piv->parent->left==temp) piv->parent->left=piv;
-					else if (piv->parent->right==temp) piv->parent->right=piv;
-				}
-							
-				//On reinsere le noeud temp dans l'arbre, ainsi que ses descendants
-				//Il sera detache de son pere courant pour etre placé ailleurs
-				insert(root,0,temp);
-				
-				//le pivot devient le noeud courant
-				temp=piv;
-				
-				//On insere les sous-arbres memorisés 
-				if (memleft!=NULL) insert(root,0,memleft);
-				if (memright!=NULL) insert(root,0,memright);
-			}
-		}	
+			if (r.left) r.parent->left=node;
+			else r.parent->right=node;
+		}
 		
-		if ( temp->left!=NULL && !goup )
+		//On empile les deux moities restantes
+		KDBuildRange sub[2];
+		sub[0].parent=node;sub[0].dim=next(r.dim);sub[0].left=true;
+		sub[0].first=r.first;sub[0].last=mid;
+		sub[1].parent=node;sub[1].dim=next(r.dim);sub[1].left=false;
+		sub[1].first=mid+1;sub[1].last=r.last;
+		for (int i=0;i<2;i++)
 		{
-			start=temp;temp=temp->left;goup=false;dim=(dim+1)%dimensions;
+			if (sub[i].last<=sub[i].first) continue;
+			if (threads!=NULL && sub[i].last-sub[i].first>=buildGrain) threads->spawn(new KDBuildTask(*this,nodes,sub[i]),worker);
+			else todo.push_back(sub[i]);
 		}
-		else if ( (temp->right!=NULL) && (!goup || start==temp->left) )
+	}
+	return top;
+}
+
+//Fonctions publiques
+template <class Object, int Dim, class Coord>
+bool KDTree<Object,Dim,Coord>::insert(const KDObj& data)
+{
+	KDNode* newone=newNode(data);
+	return insert(root,0,newone);
+}
+template <class Object, int Dim, class Coord>
+template <class InputIterator>
+bool KDTree<Object,Dim,Coord>::build(InputIterator first, InputIterator last)
+{
+	vector<KDNode*> nodes;
+	//Les noeuds deja presents sont repris dans la nouvelle repartition
+	if (root!=NULL) collect(root,nodes,true);
+	for(;first!=last;++first)
+	{
+		nodes.push_back(newNode(*first));
+	}
+	root=build(nodes,0);
+#ifdef BBOX
+	if (root!=NULL) bound(root);
+#endif
+	return true;
+}
+template <class Object, int Dim, class Coord>
+template <class InputIterator>
+bool KDTree<Object,Dim,Coord>::build(InputIterator first, InputIterator last, KDThreadPool& threads)
+{
+	vector<KDNode*> nodes;
+	if (root!=NULL) collect(root,nodes,true);
+	for(;first!=last;++first)
+	{
+		nodes.push_back(newNode(*first));
+	}
+	root=NULL;
+	if (nodes.empty()) return true;
+	
+	//Le premier niveau partage tout le tableau, les taches se divisent ensuite
+	KDBuildRange r;
+	r.first=0;r.last=nodes.size();r.parent=NULL;r.left=true;r.dim=0;
+	threads.run(new KDBuildTask(*this,nodes,r));
+	//La racine est la mediane du tableau entier
+	root=nodes[nodes.size()/2];
+#ifdef BBOX
+	bound(root);
+#endif
+	return true;
+}
+template <class Object, int Dim, class Coord>
+bool KDTree<Object,Dim,Coord>::minmax(Coord* min,Coord* max) const
+{
+	if (count()>0)
+	{
+#ifdef BBOX
+		//Sans noeud supprime, la boite de la racine est exacte
+		if (root->dead==0)
 		{
-			start=temp;temp=temp->right;goup=false;dim=(dim+1)%dimensions;
+			KDUnroll<Dim>::copy(min,root->lo);
+			KDUnroll<Dim>::copy(max,root->hi);
+			return true;
 		}
-		else //Dans les autres cas on remonte
+#endif
+		for (short i=0;i<dimensions;i++)
 		{
-			start=temp;temp=temp->parent;goup=true;dim=(dim-1)%dimensions;
+			min[i]=numeric_limits<Coord>::max();
+			max[i]=KDLowest<Coord>();
 		}
-		
+		return minmax(root,min,max);
 	}
-	if(!goup) {cout << "ERROR" << endl; exit(-1);}
-	//On est sorti de la boucle en remontant l'arbre
-	//On rattache le noeud de depart
-	start->parent=pmem;
-	return true;
+	else
+		return false;
 }
 
-template <class Object>
-long
-KDTree<Object>::count(KDNode* start)
+template <class Object, int Dim, class Coord>
+typename KDTree<Object,Dim,Coord>::KDRes KDTree<Object,Dim,Coord>::findNN(const Coord* point) const
 {
-	long nbNodes=0;
-	//On detache le noeud de depart
-	KDNode* pmem=start->parent;
-	start->parent=NULL;
-	
-	KDNode* temp=start;
-	bool goup=false;//pour signaler de remonter
-	while(temp!=NULL)
+	return findNN(point,0);
+}
+template <class Object, int Dim, class Coord>
+typename KDTree<Object,Dim,Coord>::KDRes KDTree<Object,Dim,Coord>::findNN(const Coord* point,const Dist epsilon,size_t maxVisits) const
+{
+	KDRes res;
+	const KDNode* neighb=NULL;
+	Dist dist(res.dist);
+
+	if (root!=NULL)
 	{
-		if (!goup)
+		bool found=findNN(root,0,point,neighb,dist,epsilon,maxVisits);
+		if(found)
 		{
-			nbNodes++;
+			res=KDRes(neighb->data(),dist);
 		}
-		
-		if ( temp->left!=NULL && !goup )
+	}
+	return res;
+	
+}
+template <class Object, int Dim, class Coord>
+vector<typename KDTree<Object,Dim,Coord>::KDRes> KDTree<Object,Dim,Coord>::findNear(const Coord* point, const Dist radius) const
+{
+	vector< KDRes > neighbor;
+	findNear(point,radius,neighbor);
+	return neighbor;
+}
+template <class Object, int Dim, class Coord>
+size_t KDTree<Object,Dim,Coord>::findNear(const Coord* point, const Dist radius,vector<KDRes>& result) const
+{
+	size_t nb=result.size();
+	KDNearCollect collect(result);
+	if (root!=NULL) findNear(root,0,point,radius,collect);
+	return result.size()-nb;
+}
+template <class Object, int Dim, class Coord>
+long KDTree<Object,Dim,Coord>::countNear(const Coord* point, const Dist radius) const
+{
+#ifdef BBOX
+	const Dist sqradius=radius*radius;
+	long nb=0;
+	KDSTAT(KDQueryStats qs);
+	KDStack<const KDNode*> todo;
+	if (root!=NULL) todo.push(root);
+	while(!todo.empty())
+	{
+		const KDNode* temp=todo.pop();
+		//Sous arbre hors du rayon, ou entierement dedans
+		if (boxNear(temp,point)>sqradius)
 		{
-			start=temp;temp=temp->left;goup=false;
+			KDSTAT(qs.pruned++);
+			continue;
 		}
-		else if ( (temp->right!=NULL) && (!goup || start==temp->left) )
+		if (boxFar(temp,point)<=sqradius)
 		{
-			start=temp;temp=temp->right;goup=false;
+			KDSTAT(qs.hits+=temp->size-temp->dead);
+			nb+=temp->size-temp->dead;
+			continue;
 		}
-		else //Dans les autres cas on remonte
+		KDSTAT(qs.visited++;qs.distances++);
+		if (!temp->removed && temp->data().sqdist(point)<=sqradius)
 		{
-			start=temp;temp=temp->parent;goup=true;
+			KDSTAT(qs.hits++);
+			nb++;
 		}
-				
-		
-		/*** ALGO OK***
-		//Mais pas pratique
-		while(!goup)
+		if (temp->left!=NULL) todo.push(temp->left);
+		if (temp->right!=NULL) todo.push(temp->right);
+		KDSTAT(qs.stack(todo.size()));
+	}
+	KDSTAT(record(qs));
+	return nb;
+#else
+	return forEachNear(point,radius,KDCounter()).nb;
+#endif
+}
+//Les k meilleurs candidats sont gardes dans un tas borne : la distance du k-ieme
+//(ou le rayon maximal tant que le tas n'est pas plein) sert a elaguer les sous arbres
+template <class Object, int Dim, class Coord>
+vector<typename KDTree<Object,Dim,Coord>::KDRes> KDTree<Object,Dim,Coord>::findKNN(const Coord* point,size_t k,const Dist maxRadius,const Dist epsilon,size_t maxVisits) const
+{
+	vector<KDRes> neighbor;
+	if (root==NULL || k==0) return neighbor;
+	
+	const Dist sqmax=(maxRadius<sqrt(numeric_limits<Dist>::max())) ? maxRadius*maxRadius : numeric_limits<Dist>::max();
+	vector<KDCandidate> heap;
+	heap.reserve(k);
+	//Recherche approchee : le k-ieme candidat elague a sa distance divisee par 1+epsilon
+	const Dist factor=(1+epsilon)*(1+epsilon);
+	size_t visits=0;
+	KDSTAT(KDQueryStats qs);
+	
+	KDStack<KDVisit> todo;
+	KDVisit v;
+	v.node=root;v.dim=0;v.bound=0;
+	todo.push(v);
+	while(!todo.empty() && (maxVisits==0 || visits<maxVisits))
+	{
+		v=todo.pop();
+		Dist worst=(heap.size()<k) ? sqmax : heap.front().first;
+		if (heap.size()<k ? v.bound>sqmax : v.bound*factor>worst)
 		{
-			start=temp;
-			
-			nbNodes++;
-			
-			if(start->left!=NULL) {temp=start->left;}
-			else if(start->right!=NULL) {temp=start->right;}
-			else {temp=start->parent;goup=true;}
+			KDSTAT(qs.pruned++);
+			continue;
 		}
-		while(goup && temp!=NULL)
+		
+		//On descend du cote du point, en memorisant l'autre cote
+		const KDNode* temp=v.node;
+		short dim=v.dim;
+		while(temp!=NULL && (maxVisits==0 || visits<maxVisits))
 		{
-			if(start==temp->left && temp->right!=NULL)
+			visits++;
+			KDSTAT(qs.visited++;qs.distances++);
+			Dist sum=temp->data().sqdist(point);
+			if (!temp->removed && (heap.size()<k ? sum<=sqmax : sum<worst))
 			{
-				start=temp;
-				temp=temp->right;
-				goup=false;
+				KDSTAT(qs.hits++);
+				if (heap.size()==k) {pop_heap(heap.begin(),heap.end(),farther);heap.pop_back();}
+				heap.push_back(KDCandidate(sum,temp));
+				push_heap(heap.begin(),heap.end(),farther);
+				worst=(heap.size()<k) ? sqmax : heap.front().first;
 			}
-			else
+			Dist diff=static_cast<Dist>(point[dim])-static_cast<Dist>(temp->data()[dim]);
+			const KDNode* further=(diff<=0)?temp->right:temp->left;
+#ifdef BBOX
+			Dist bound=(further!=NULL) ? boxNear(further,point) : 0;
+#else
+			Dist bound=diff*diff;
+#endif
+			if (further!=NULL && (heap.size()<k ? bound<=sqmax : bound*factor<=worst))
 			{
-				start=temp;
-				temp=temp->parent;
+				KDVisit f;
+				f.node=further;f.dim=next(dim);f.bound=bound;
+				todo.push(f);
+				KDSTAT(qs.stack(todo.size()));
 			}
-		}*/
+			KDSTAT(else if (further!=NULL) qs.pruned++);
+			temp=(diff<=0)?temp->left:temp->right;
+			dim=next(dim);
+		}
 	}
-	if(!goup) {cout << "ERROR" << endl; exit(-1);}
+	KDSTAT(record(qs));
 	
-	//On est sorti de la boucle en remontant l'arbre
-	//On rattache le noeud de depart
-	start->parent=pmem;
-	return nbNodes;
+	sort_heap(heap.begin(),heap.end(),farther);
+	neighbor.reserve(heap.size());
+	for (size_t i=0;i<heap.size();i++)
+		neighbor.push_back(KDRes(heap[i].second->data(),sqrt(heap[i].first)));
+	return neighbor;
+}
+//Ordre des points le long d'une courbe de Morton : coordonnees ramenees a des entiers sur
+//la boite des points, dont les bits sont entrelaces dimension par dimension
+template <class Object, int Dim, class Coord>
+void KDTree<Object,Dim,Coord>::mortonOrder(const Coord* points,size_t nb,vector<size_t>& order)
+{
+	order.resize(nb);
+	if (nb==0) return;
+	const int bits=min(static_cast<int>(8*sizeof(unsigned long))/Dim,31);
+	Coord min[Dim];
+	Coord max[Dim];
+	KDUnroll<Dim>::copy(min,points);
+	KDUnroll<Dim>::copy(max,points);
+	for (size_t i=1;i<nb;i++) KDUnroll<Dim>::minmax(points+i*Dim,min,max);
+	double scale[Dim];
+	for (short d=0;d<Dim;d++)
+	{
+		double extent=static_cast<double>(max[d])-static_cast<double>(min[d]);
+		scale[d]=(extent>0) ? (ldexp(1.0,bits)-1)/extent : 0.0;
+	}
+	vector< pair<unsigned long,size_t> > keys(nb);
+	for (size_t i=0;i<nb;i++)
+	{
+		unsigned long cell[Dim];
+		for (short d=0;d<Dim;d++) cell[d]=static_cast<unsigned long>((static_cast<double>(points[i*Dim+d])-static_cast<double>(min[d]))*scale[d]);
+		unsigned long code=0;
+		for (int b=bits-1;b>=0;b--)
+			for (short d=0;d<Dim;d++) code=(code<<1)|((cell[d]>>b)&1);
+		keys[i]=pair<unsigned long,size_t>(code,i);
+	}
+	sort(keys.begin(),keys.end());
+	for (size_t i=0;i<nb;i++) order[i]=keys[i].second;
 }
 
+//Chaque thread range les resultats de ses requetes a la suite dans son propre tableau
+template <class Object, int Dim, class Coord>
+void KDTree<Object,Dim,Coord>::KDNearBatch::operator () (size_t first,size_t last,int worker)
+{
+	vector<KDRes>& res=local[worker];
+	for (size_t i=first;i<last;i++)
+	{
+		const size_t q=(order==NULL) ? i : order[i];
+		owner[q]=worker;
+		start[q]=res.size();
+		found[q]=tree.findNear(points+q*Dim,radius,res);
+	}
+}
 
-//Fonctions publiques
-template <class Object>
-bool KDTree<Object>::insert(const KDObject<Object>& data)
+template <class Object, int Dim, class Coord>
+void KDTree<Object,Dim,Coord>::findNearBatch(const Coord* points,size_t nb,const Dist radius,KDBatch& result,KDThreadPool& pool,bool reorder) const
 {
-	KDNode* newone=new KDNode(data);
-	return insert(root,0,newone);
+	result.offsets.assign(nb+1,0);
+	result.hits.clear();
+	if (root==NULL || nb==0) return;
+	
+	vector<size_t> order;
+	if (reorder) mortonOrder(points,nb,order);
+	KDNearBatch batch(*this,points,nb,radius,reorder ? &order[0] : NULL,pool.size());
+	pool.parallelFor(0,nb,64,batch);
+	
+	//On regroupe les resultats dans l'ordre des requetes
+	for (size_t i=0;i<nb;i++) result.offsets[i+1]=result.offsets[i]+batch.found[i];
+	result.hits.reserve(result.offsets[nb]);
+	for (size_t i=0;i<nb;i++)
+	{
+		const vector<KDRes>& res=batch.local[batch.owner[i]];
+		result.hits.insert(result.hits.end(),res.begin()+batch.start[i],res.begin()+batch.start[i]+batch.found[i]);
+	}
 }
-template <class Object>
-bool KDTree<Object>::minmax(float* min,float* max)
+
+template <class Object, int Dim, class Coord>
+void KDTree<Object,Dim,Coord>::KDNNBatch::operator () (size_t first,size_t last,int)
 {
-	if (root!=NULL)
+	for (size_t i=first;i<last;i++)
 	{
-		for (short i=0; i<dimensions ; i++)
-		{
-			min[i]=root->data()[i];
-			max[i]=root->data()[i];
-		}
-		return minmax(root,0,min,max);
+		const size_t q=(order==NULL) ? i : order[i];
+		result[q]=tree.findNN(points+q*Dim);
 	}
-	else
-		return false;
 }
 
-template <class Object>
-KDObjDist<Object> KDTree<Object>::findNN(const float* point)
+template <class Object, int Dim, class Coord>
+void KDTree<Object,Dim,Coord>::findNNBatch(const Coord* points,size_t nb,vector<KDRes>& result,KDThreadPool& pool,bool reorder) const
 {
-	KDObjDist<Object> res;
-	const KDNode* neighb=NULL;
-	float dist(res.dist);
+	result.assign(nb,KDRes());
+	if (nb==0) return;
+	vector<size_t> order;
+	if (reorder) mortonOrder(points,nb,order);
+	KDNNBatch batch(*this,points,reorder ? &order[0] : NULL,result);
+	pool.parallelFor(0,nb,64,batch);
+}
 
-	if (root!=NULL)
+template <class Object, int Dim, class Coord>
+vector<Object> KDTree<Object,Dim,Coord>::findInAABox(const Coord* min,const Coord* max) const
+{
+	vector<Object> objects;
+	KDCollect collect(objects);
+	if (root!=NULL) findInAABox(root,0,min,max,collect);
+	return objects;
+}
+
+template <class Object, int Dim, class Coord>
+long KDTree<Object,Dim,Coord>::countInAABox(const Coord* min,const Coord* max) const
+{
+#ifdef BBOX
+	long nb=0;
+	KDSTAT(KDQueryStats qs);
+	KDStack<const KDNode*> todo;
+	if (root!=NULL) todo.push(root);
+	while(!todo.empty())
 	{
-		bool found=findNN(root,0,point,neighb,dist);
-		if(found)
+		const KDNode* temp=todo.pop();
+		bool disjoint=false,contained=true;
+		for (short i=0;i<dimensions;i++)
+		{
+			disjoint=disjoint || temp->hi[i]<min[i] || max[i]<temp->lo[i];
+			contained=contained && min[i]<=temp->lo[i] && temp->hi[i]<=max[i];
+		}
+		if (disjoint)
 		{
-			res=neighb;
-			res.dist=dist;
+			KDSTAT(qs.pruned++);
+			continue;
 		}
+		if (contained)
+		{
+			KDSTAT(qs.hits+=temp->size-temp->dead);
+			nb+=temp->size-temp->dead;
+			continue;
+		}
+		KDSTAT(qs.visited++);
+		const KDObj& data=temp->data();
+		bool in=!temp->removed;
+		for (short i=0;i<dimensions && in;i++) in=(min[i]<=data[i] && data[i]<=max[i]);
+		if (in)
+		{
+			KDSTAT(qs.hits++);
+			nb++;
+		}
+		if (temp->left!=NULL) todo.push(temp->left);
+		if (temp->right!=NULL) todo.push(temp->right);
+		KDSTAT(qs.stack(todo.size()));
 	}
-	return res;
-	
+	KDSTAT(record(qs));
+	return nb;
+#else
+	KDCounter counter;
+	if (root!=NULL) findInAABox(root,0,min,max,counter);
+	return counter.nb;
+#endif
 }
-template <class Object>
-vector< KDObjDist<Object> > KDTree<Object>::findNear(const float* point, float radius)
-{
-	vector<const KDNode*> neighb;
-	vector< KDObjDist<Object> > neighbor;
-	vector<float> dist;
 
+template <class Object, int Dim, class Coord>
+bool KDTree<Object,Dim,Coord>::balance(void)
+{
 	if (root!=NULL)
 	{
-		bool res=findNear(root,0,point,radius,neighb,dist);
-		if (res) 
-			for (unsigned int i=0;i<neighb.size();i++)
+		vector<KDNode*> path(1,root);
+		rebuild(path,0);
+		return true;
+	}
+	else
+		return false;
+}
+//Les objets sont seulement marques comme supprimes, en O(log n)
+//Un sous arbre est reconstruit des que sa part de noeuds supprimes depasse deadRatio
+template <class Object, int Dim, class Coord>
+bool KDTree<Object,Dim,Coord>::remove(const Coord* point,const Object& obj)
+{
+	//Parcours en profondeur : path[0..depth] est le chemin depuis la racine
+	vector<KDNode*> path;
+	vector< pair<KDNode*,size_t> > todo;
+	if (root!=NULL) todo.push_back(pair<KDNode*,size_t>(root,0));
+	while(!todo.empty())
+	{
+		KDNode* temp=todo.back().first;
+		size_t depth=todo.back().second;
+		todo.pop_back();
+		path.resize(depth);
+		path.push_back(temp);
+		
+		const KDObj& data=temp->data();
+		bool same=!temp->removed && data.obj==obj;
+		for (short i=0;i<dimensions && same;i++) same=(data[i]==point[i]);
+		if (same)
+		{
+			temp->removed=true;
+			for (size_t i=0;i<=depth;i++) path[i]->dead++;
+			//On reconstruit le plus haut sous arbre trop creux
+			for (size_t i=0;i<=depth;i++)
 			{
-				neighbor.push_back(KDObjDist<Object>(neighb[i]->data().obj,dist[i]));
+				if (path[i]->dead>deadRatio*path[i]->size)
+				{
+					rebuild(path,i);
+					break;
+				}
 			}
+			return true;
+		}
+		
+		//Les coordonnees egales a la coupe peuvent etre des deux cotes
+		short dim=depth%dimensions;
+		if (temp->right!=NULL && point[dim]>=data[dim]) todo.push_back(pair<KDNode*,size_t>(temp->right,depth+1));
+		if (temp->left!=NULL && point[dim]<=data[dim]) todo.push_back(pair<KDNode*,size_t>(temp->left,depth+1));
 	}
-	return neighbor;
+	return false;
 }
-template <class Object>
-bool KDTree<Object>::balance(void)
+
+template <class Object, int Dim, class Coord>
+template <class Predicate>
+long KDTree<Object,Dim,Coord>::removeIf(Predicate pred)
 {
-	if (root!=NULL)
-		return balance(root,0);
-	else
-		return false;
+	if (root==NULL) return 0;
+	long nb=0;
+	
+	//On marque les objets, puis on recompte les sous arbres en partant des feuilles
+	vector<KDNode*> nodes;
+	collect(root,nodes);
+	for (size_t i=0;i<nodes.size();i++)
+	{
+		if (!nodes[i]->removed && pred(nodes[i]->data()))
+		{
+			nodes[i]->removed=true;
+			nb++;
+		}
+	}
+	for (size_t i=nodes.size();i>0;i--)
+	{
+		KDNode* temp=nodes[i-1];
+		temp->size=1;
+		temp->dead=temp->removed ? 1 : 0;
+		if (temp->left!=NULL) {temp->size+=temp->left->size;temp->dead+=temp->left->dead;}
+		if (temp->right!=NULL) {temp->size+=temp->right->size;temp->dead+=temp->right->dead;}
+	}
+	
+	//Puis on reconstruit les plus hauts sous arbres trop creux
+	vector<KDNode*> path;
+	vector< pair<KDNode*,size_t> > todo;
+	todo.push_back(pair<KDNode*,size_t>(root,0));
+	while(!todo.empty())
+	{
+		KDNode* temp=todo.back().first;
+		size_t depth=todo.back().second;
+		todo.pop_back();
+		path.resize(depth);
+		path.push_back(temp);
+		if (temp->dead>deadRatio*temp->size) rebuild(path,depth);
+		else
+		{
+			if (temp->right!=NULL) todo.push_back(pair<KDNode*,size_t>(temp->right,depth+1));
+			if (temp->left!=NULL) todo.push_back(pair<KDNode*,size_t>(temp->left,depth+1));
+		}
+	}
+	return nb;
 }
-template <class Object>
-long KDTree<Object>::count(void)
+
+template <class Object, int Dim, class Coord>
+long KDTree<Object,Dim,Coord>::count(void) const
 {
 	if (root!=NULL)
 		return count(root);
 	else return 0;
 }
-template <class Object>
-void KDTree<Object>::stats(void)
+#ifdef KDSTATS
+//Les compteurs cumules sont mis a jour atomiquement : plusieurs threads peuvent chercher a la fois
+template <class Object, int Dim, class Coord>
+void KDTree<Object,Dim,Coord>::record(const KDQueryStats& qs) const
+{
+	KDQueryStats one=qs;
+	one.queries=1;
+	last.set(one);
+	__sync_fetch_and_add(&totals.queries,1);
+	__sync_fetch_and_add(&totals.visited,qs.visited);
+	__sync_fetch_and_add(&totals.distances,qs.distances);
+	__sync_fetch_and_add(&totals.pruned,qs.pruned);
+	__sync_fetch_and_add(&totals.hits,qs.hits);
+	long top=totals.maxstack;
+	while (qs.maxstack>top && !__sync_bool_compare_and_swap(&totals.maxstack,top,qs.maxstack)) top=totals.maxstack;
+}
+#endif
+
+template <class Object, int Dim, class Coord>
+void KDTree<Object,Dim,Coord>::stats(void) const
 {
 	long nbNodes=count();
 	cout << "NbNodes Stored : " << nbNodes << endl;
+	if (root!=NULL) cout << "Live / Removed (not yet purged) : " << nbNodes << " / " << root->dead << endl;
 	if (nbNodes>0)
 	{
 		cout << "AABoundingBox : " << endl;
-		float* min=new float[dimensions];
-		float* max=new float[dimensions];
+		Coord min[Dim];
+		Coord max[Dim];
 		minmax(min,max);
 		for (int i=0;i<dimensions;i++)
 			cout << "Dim " << i << " : Min = " <<min[i] <<" , Max = "<<max[i] <<endl;
 		
-		cout << "Memory Used : " << nbNodes *  sizeof(KDNode) / 1024 << endl;
+		cout << "Memory Used : " << pool.allocated() / 1024 << endl;
+		cout << "Allocated bytes : " << pool.footprint() << " (" << root->size << " nodes of " << sizeof(KDNode) << " bytes, " << pool.available() << " free slots)" << endl;
+		
+		//Repartition des noeuds selon leur profondeur
+		vector<long> depths;
+		vector< pair<const KDNode*,size_t> > todo;
+		todo.push_back(pair<const KDNode*,size_t>(root,0));
+		double sum=0.0,leafsum=0.0;
+		long leaves=0;
+		while(!todo.empty())
+		{
+			const KDNode* temp=todo.back().first;
+			size_t depth=todo.back().second;
+			todo.pop_back();
+			if (depth>=depths.size()) depths.resize(depth+1,0);
+			depths[depth]++;
+			sum+=depth;
+			if (temp->left==NULL && temp->right==NULL)
+			{
+				leaves++;
+				leafsum+=depth;
+			}
+			if (temp->left!=NULL) todo.push_back(pair<const KDNode*,size_t>(temp->left,depth+1));
+			if (temp->right!=NULL) todo.push_back(pair<const KDNode*,size_t>(temp->right,depth+1));
+		}
+		cout << "Depth : Max = " << depths.size()-1 << " , Mean = " << sum/root->size << " , Mean leaf depth = " << leafsum/leaves << endl;
+		cout << "Nodes per depth :";
+		for (size_t i=0;i<depths.size() && i<64;i++) cout << ' ' << depths[i];
+		if (depths.size()>64) cout << " ...";
+		cout << endl;
+		//Desequilibre : profondeur maximale rapportee a celle d'un arbre equilibre (1 : equilibre)
+		size_t optimal=0;
+		for (long full=1;full<root->size;full=2*full+1) optimal++;
+		cout << "Imbalance : Max depth / balanced depth = " << (optimal>0 ? static_cast<double>(depths.size()-1)/optimal : 1.0) << endl;
+#ifdef KDSTATS
+		if (totals.queries>0)
+		{
+			const double q=static_cast<double>(totals.queries);
+			cout << "Queries : " << totals.queries << " , per query : visited = " << totals.visited/q << " , distances = " << totals.distances/q
+				<< " , pruned = " << totals.pruned/q << " , hits = " << totals.hits/q << " , max stack = " << totals.maxstack << endl;
+		}
+#endif
 	}
 	else
 	{
 		cout << "No Nodes... No tests made..." << endl;
 	}
 }
+
+template <class Object, int Dim, class Coord>
+void KDTree<Object,Dim,Coord>::clear(void)
+{
+	//Les objets stockes sont detruits un par un, puis les blocs rendus en une fois
+	vector<KDNode*> todo;
+	if (root!=NULL) todo.push_back(root);
+	while(!todo.empty())
+	{
+		KDNode* temp=todo.back();todo.pop_back();
+		if (temp->left!=NULL) todo.push_back(temp->left);
+		if (temp->right!=NULL) todo.push_back(temp->right);
+		temp->~KDNode();
+	}
+	pool.clear();
+	root=NULL;
+}
@@ -1,135 +1,484 @@
 #ifndef KDTREE_HH
 #define KDTREE_HH 1
 
+//Nombre de dimensions par defaut des KDObject / KDTree
+#ifndef DIMENSIONS
 #define DIMENSIONS 3
+#endif
 
 #include <vector>
+#include <algorithm>
 #include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <new>
+#include "KDPool.hh"
+#include "KDThreadPool.hh"
 using namespace std;
 
+//Type utilise pour les distances selon le type des coordonnees
+//Les coordonnees entieres sont comparees en double pour eviter les debordements
+template <class Coord> struct KDDistance { typedef Coord type; };
+template <> struct KDDistance<int> { typedef double type; };
+template <> struct KDDistance<long> { typedef double type; };
+
+//Boucles sur les dimensions deroulees a la compilation
+template <int D> struct KDUnroll
+{
+	template <class Coord, class Dist> static inline Dist sqdist(const Coord* a,const Coord* b)
+	{
+		Dist d=static_cast<Dist>(a[D-1])-static_cast<Dist>(b[D-1]);
+		return KDUnroll<D-1>::template sqdist<Coord,Dist>(a,b)+d*d;
+	}
+	template <class Coord> static inline void copy(Coord* dst,const Coord* src)
+	{
+		KDUnroll<D-1>::copy(dst,src);
+		dst[D-1]=src[D-1];
+	}
+	template <class Coord> static inline void minmax(const Coord* p,Coord* min,Coord* max)
+	{
+		KDUnroll<D-1>::minmax(p,min,max);
+		if (p[D-1]<min[D-1]) min[D-1]=p[D-1];
+		if (p[D-1]>max[D-1]) max[D-1]=p[D-1];
+	}
+};
+template <> struct KDUnroll<0>
+{
+	template <class Coord, class Dist> static inline Dist sqdist(const Coord*,const Coord*) { return Dist(0); }
+	template <class Coord> static inline void copy(Coord*,const Coord*) {}
+	template <class Coord> static inline void minmax(const Coord*,Coord*,Coord*) {}
+};
+
+//Plus petite valeur d'un type de coordonnees (numeric_limits::min est positif pour les flottants)
+template <class Coord> inline Coord KDLowest(void)
+{
+	return numeric_limits<Coord>::is_integer ? numeric_limits<Coord>::min() : -numeric_limits<Coord>::max();
+}
+
+//Pile pour les parcours d'arbre : les N premiers elements sont stockes sur place,
+//seuls les arbres tres desequilibres debordent dans un vector
+template <class T, int N=64> class KDStack
+{
+	T local[N];
+	vector<T> more;
+	int top;
+	public:
+	KDStack() : top(0) {}
+	inline bool empty(void) const { return top==0; }
+	inline int size(void) const { return top; }
+	inline void push(const T& t)
+	{
+		if (top<N) local[top]=t;
+		else more.push_back(t);
+		top++;
+	}
+	inline T pop(void)
+	{
+		top--;
+		if (top<N) return local[top];
+		T t=more.back();
+		more.pop_back();
+		return t;
+	}
+};
+
 //Classe Template pour les objets a classer dans le KDTree
 //Cette classe doit disposer d'un code d'erreur, pour indiquer une recherche sans resultat par exemple
 
 //Classe pour les objets a classer dans le KDTree
-template <class Object> class KDObject
+template <class Object, int Dim=DIMENSIONS, class Coord=float> class KDObject
 {
-	//Meme nombre de dimensions pour tous les objets, attention a la coherence
-	static const int dimensions = DIMENSIONS;
+	//Meme nombre de dimensions pour tous les objets, fixe a la compilation
+	static const int dimensions = Dim;
 	
 	public:
-	//Tableau de coordonnes, Attention a la dimensions lors des acces aux coords
-	float* coords;
+	typedef typename KDDistance<Coord>::type Dist;
+	//Tableau de coordonnes, stocke dans l'objet (pas d'allocation)
+	Coord coords[Dim];
 	//Stockage de l'objet
 	const Object obj;
 	
-	KDObject(const Object& o=Object::ERROR) : obj(o) {coords=new float[dimensions];}
-	KDObject(const Object& o,float* c) : obj(o) {coords=c;}
-	KDObject(const KDObject& toStore) : obj(toStore.obj)
-	{
-		coords=new float[dimensions];
-		for(int i=0;i<dimensions;i++)
-		{
-			coords[i]=toStore.coords[i];
-		}
-	}
-	~KDObject() {delete coords;}
+	KDObject(const Object& o=Object::ERROR) : obj(o) {}
+	KDObject(const Object& o,const Coord* c) : obj(o) {KDUnroll<Dim>::copy(coords,c);}
 	
 	//Accesseurs aux coordonnees
-	inline float operator [] (int i) const { return *(coords + i % dimensions); }
-	inline float &operator [] (int i) { return *(coords + i % dimensions); }
+	inline Coord operator [] (int i) const { return coords[i]; }
+	inline Coord &operator [] (int i) { return coords[i]; }
 	
 	//Calcul des distances
-	inline float sqdist(const float* point) const
+	inline Dist sqdist(const Coord* point) const
 	{
-		float sum=0.0f;
-		for (int i=0;i<dimensions;i++)
-		{
-			sum+=(point[i]-coords[i])*(point[i]-coords[i]);
-		}
-		return sum;
+		return KDUnroll<Dim>::template sqdist<Coord,Dist>(point,coords);
 	}
-	inline float dist(const float* point) const {return sqrtf(sqdist(point));}
+	inline Dist dist(const Coord* point) const {return sqrt(sqdist(point));}
 	
 };
 
 //Type retourn lors d'une requete de recherche au KDTree
-template <class Object> class KDObjDist
+template <class Object, int Dim=DIMENSIONS, class Coord=float> class KDObjDist
 {
 	public:
-	float dist;
+	typedef typename KDDistance<Coord>::type Dist;
+	Dist dist;
 	Object object; //Pour recopier la valeur et laisser le KDTree intact
 
 	
-	KDObjDist(const Object & o=Object::ERROR, float d=-1.0f) : dist(d) , object(o) {}
-	KDObjDist(const KDObject<Object> & o, float d=-1.0f) : dist(d), object(o->obj) {}
+	KDObjDist(const Object & o=Object::ERROR, Dist d=-1) : dist(d) , object(o) {}
+	KDObjDist(const KDObject<Object,Dim,Coord> & o, Dist d=-1) : dist(d), object(o.obj) {}
+};
+
+//Resultats d'une requete groupee, au format CSR : les resultats de la requete i
+//sont hits[offsets[i]] a hits[offsets[i+1]-1]
+template <class Object, int Dim=DIMENSIONS, class Coord=float> class KDBatchRes
+{
+	public:
+	vector<size_t> offsets;
+	vector< KDObjDist<Object,Dim,Coord> > hits;
+	
+	//Nombre de requetes
+	size_t size(void) const { return offsets.empty() ? 0 : offsets.size()-1; }
+	//Nombre de resultats de la requete i
+	size_t count(size_t i) const { return offsets[i+1]-offsets[i]; }
+};
+
+//Compteurs des recherches, compiles seulement avec KDSTATS : sans, ils ne coutent rien
+#ifdef KDSTATS
+#define KDSTAT(x) x
+#else
+#define KDSTAT(x)
+#endif
+
+struct KDQueryStats
+{
+	long queries;//nombre de recherches
+	long visited;//noeuds visites
+	long distances;//distances calculees
+	long pruned;//sous arbres elimines sans y descendre
+	long hits;//objets trouves (ou meilleurs voisins successifs pour findNN)
+	long maxstack;//profondeur maximale de la pile des noeuds a visiter
+	KDQueryStats() : queries(0), visited(0), distances(0), pruned(0), hits(0), maxstack(0) {}
+	inline void stack(size_t s) { if (static_cast<long>(s)>maxstack) maxstack=s; }
 };
 
-template <class Object> class KDTree
+//Compteurs de la derniere recherche, ecrits et lus sous un verrou tournant : les
+//recherches paralleles d'un lot (findNearBatch, findNNBatch) les ecrivent en meme temps
+class KDLastStats
+{
+	KDQueryStats value;
+	mutable volatile int lock;
+	void acquire(void) const { while (!__sync_bool_compare_and_swap(&lock,0,1)) {} }
+	void release(void) const { __sync_lock_release(&lock); }
+	public:
+	KDLastStats() : lock(0) {}
+	void set(const KDQueryStats& qs) { acquire(); value=qs; release(); }
+	KDQueryStats get(void) const { acquire(); KDQueryStats qs=value; release(); return qs; }
+};
+
+template <class Object, int Dim, class Coord> class KDFrozenTree;
+
+template <class Object, int Dim=DIMENSIONS, class Coord=float> class KDTree
 {
-	static const int dimensions=DIMENSIONS;
+	//La version figee lit directement les noeuds
+	friend class KDFrozenTree<Object,Dim,Coord>;
+
+	static const int dimensions=Dim;
+	
+	public:
+	typedef KDObject<Object,Dim,Coord> KDObj;
+	typedef KDObjDist<Object,Dim,Coord> KDRes;
+	typedef KDBatchRes<Object,Dim,Coord> KDBatch;
+	typedef typename KDDistance<Coord>::type Dist;
+	
+	private:
+	//Dimension de coupe suivante / precedente (sans modulo)
+	static inline short next(short dim) { return (dim+1==Dim) ? 0 : dim+1; }
+	static inline short prev(short dim) { return (dim==0) ? Dim-1 : dim-1; }
 			
 	class KDNode
 	{
 		private:
-		const KDObject<Object> _data;
+		const KDObj _data;
 		public:
 		KDNode* left;
 		KDNode* right;
 #ifndef REC
+		//Aucun parcours ne remonte par le pere (ils utilisent une pile) : avec REC, il n'est pas stocke
 		KDNode* parent;
+#endif
+		//Nombre de noeuds du sous arbre (lui compris), dont supprimes
+		long size;
+		long dead;
+		//Objet supprime, le noeud reste en place jusqu'a la reconstruction du sous arbre
+		bool removed;
+#ifdef BBOX
+		//Boite englobante du sous arbre, noeuds supprimes compris jusqu'a sa reconstruction
+		Coord lo[Dim];
+		Coord hi[Dim];
 #endif
 		//Constructeur et Destructeur
-		KDNode(const KDObject<Object>& d=KDObject<Object>(Object::ERROR)) : _data(d) 
+		KDNode(const KDObj& d=KDObj(Object::ERROR)) : _data(d) 
 		{
 			left=NULL;right=NULL;
+			size=1;dead=0;removed=false;
+#ifdef BBOX
+			KDUnroll<Dim>::copy(lo,_data.coords);
+			KDUnroll<Dim>::copy(hi,_data.coords);
+#endif
 #ifndef	REC
 			parent=NULL;
 #endif
 		}
-		~KDNode() {delete left; delete right;}
 		//Accesseur
-		const KDObject<Object>& data(void) const { return _data;}
+		const KDObj& data(void) const { return _data;}
 	};
 	
 	KDNode* root;
+	//Part maximale de noeuds supprimes dans un sous arbre avant sa reconstruction
+	double deadRatio;
+	//Poids maximal d'un fils par rapport a son pere en mode auto-equilibre (0 : desactive)
+	double alpha;
+	//Les noeuds sont alloues par blocs, propres a chaque arbre
+	KDPool<KDNode> pool;
+	
+	//Foncteur de comparaison des noeuds selon une dimension (pour nth_element)
+	class KDNodeCompare
+	{
+		short dim;
+		public:
+		KDNodeCompare(short d) : dim(d) {}
+		bool operator () (const KDNode* a,const KDNode* b) const { return a->data()[dim] < b->data()[dim]; }
+	};
+	//Sous arbre restant a visiter lors d'une recherche, avec sa distance minimale (au carre)
+	struct KDVisit
+	{
+		const KDNode* node;
+		short dim;
+		Dist bound;
+	};
+	//Sous arbre restant a visiter lors d'une recherche dans une boite, avec sa cellule
+	//(la region delimitee par les plans de coupe de ses ancetres)
+	struct KDCell
+	{
+		const KDNode* node;
+		short dim;
+		Coord lo[Dim];
+		Coord hi[Dim];
+	};
+	//Visiteur des recherches dans un rayon, qui ajoute les resultats a un tableau
+	class KDNearCollect
+	{
+		vector<KDRes>& result;
+		public:
+		KDNearCollect(vector<KDRes>& r) : result(r) {}
+		inline void operator () (const KDObj& data,Dist sqdist) { result.push_back(KDRes(data,sqrt(sqdist))); }
+	};
+	//Visiteurs utilises par les recherches dans une boite
+	class KDCollect
+	{
+		vector<Object>& objects;
+		public:
+		KDCollect(vector<Object>& o) : objects(o) {}
+		inline void operator () (const KDObj& data) { objects.push_back(data.obj); }
+	};
+	class KDCounter
+	{
+		public:
+		long nb;
+		KDCounter() : nb(0) {}
+		inline void operator () (const KDObj&) { nb++; }
+		inline void operator () (const KDObj&,Dist) { nb++; }
+	};
+	//Candidat d'une recherche des k plus proches voisins, le plus eloigne en tete du tas
+	typedef pair<Dist,const KDNode*> KDCandidate;
+	static inline bool farther(const KDCandidate& a,const KDCandidate& b) { return a.first<b.first; }
+	//Corps des boucles paralleles des requetes groupees
+	class KDNearBatch : public KDThreadPool::Body
+	{
+		const KDTree& tree;
+		const Coord* points;
+		const Dist radius;
+		//Ordre de traitement des requetes (NULL : dans l'ordre)
+		const size_t* order;
+		public:
+		//Resultats de chaque thread, et pour chaque requete : thread, debut et nombre de ses resultats
+		vector< vector<KDRes> > local;
+		vector<int> owner;
+		vector<size_t> start;
+		vector<size_t> found;
+		KDNearBatch(const KDTree& t,const Coord* p,size_t nb,Dist r,const size_t* o,int nbthreads) : tree(t), points(p), radius(r), order(o), local(nbthreads), owner(nb), start(nb), found(nb) {}
+		void operator () (size_t first,size_t last,int worker);
+	};
+	friend class KDNearBatch;
+	class KDNNBatch : public KDThreadPool::Body
+	{
+		const KDTree& tree;
+		const Coord* points;
+		const size_t* order;
+		vector<KDRes>& result;
+		public:
+		KDNNBatch(const KDTree& t,const Coord* p,const size_t* o,vector<KDRes>& r) : tree(t), points(p), order(o), result(r) {}
+		void operator () (size_t first,size_t last,int worker);
+	};
+	friend class KDNNBatch;
+	//Intervalle de noeuds restant a placer lors d'une construction equilibree
+	struct KDBuildRange
+	{
+		size_t first,last;
+		KDNode* parent;
+		bool left;
+		short dim;
+	};
+	//Construction d'un sous arbre par un thread du groupe
+	class KDBuildTask : public KDThreadPool::Task
+	{
+		KDTree& tree;
+		vector<KDNode*>& nodes;
+		const KDBuildRange range;
+		public:
+		KDBuildTask(KDTree& t,vector<KDNode*>& n,const KDBuildRange& r) : tree(t), nodes(n), range(r) {}
+		void run(KDThreadPool& threads,int worker) { tree.build(nodes,range,&threads,worker); }
+	};
+	friend class KDBuildTask;
+	//Taille minimale d'un sous arbre construit par une tache a part
+	static const size_t buildGrain=16384;
 	
 	//Fonctions de manipulation internes
-#ifdef REC
-	bool insert(KDNode*& start,short dimstart, KDNode* node);
-#else
 	bool insert(KDNode* start,short dimstart, KDNode* node);
+	bool minmax(const KDNode* start,Coord* min,Coord* max) const;
+	bool findNN(const KDNode* start,short dimstart,const Coord* point,const KDNode*& neighbor, Dist& dist,const Dist epsilon=0,size_t maxVisits=0) const;
+	template <class Visitor> void findNear(const KDNode* start,short dimstart,const Coord* point,const Dist radius,Visitor& visit) const;
+	template <class Visitor> void findInAABox(const KDNode* start,short dimstart,const Coord* min,const Coord* max,Visitor& visit) const;
+	void rebuild(vector<KDNode*>& path,size_t depth);
+	long count(const KDNode* start) const;
+	void collect(KDNode* start,vector<KDNode*>& nodes,bool purge=false);
+	KDNode* build(vector<KDNode*>& nodes,short dimstart);
+	KDNode* build(vector<KDNode*>& nodes,const KDBuildRange& range,KDThreadPool* threads,int worker);
+	KDNode* newNode(const KDObj& data) { return new (pool.allocate()) KDNode(data); }
+	static void mortonOrder(const Coord* points,size_t nb,vector<size_t>& order);
+#ifdef KDSTATS
+	mutable KDQueryStats totals;
+	mutable KDLastStats last;
+	void record(const KDQueryStats& qs) const;
 #endif
-	//suppr(KDNode* start,int dimstart);
-	bool minmax(KDNode* start,short dimstart,float* min,float* max);
-	bool findNN(KDNode* start,short dimstart,const float* point,const KDNode*& neighbor, float& dist);
-	bool findNear(KDNode* start,short dimstart,const float* point, float radius,vector<const KDNode*>& neighbor, vector<float>& dist);
-	//findinAABox(KDNode* start,short dimstart,const float*& min,const float*& max);
-#ifndef REC
-		KDNode* pivot(const KDNode* start, short dimstart);
-#endif
-#ifdef REC
-	bool balance(KDNode*& start,short dimstart);
-#else
-	bool balance(KDNode* start,short dimstart);
+#ifdef BBOX
+	void bound(KDNode* start);
+	//Boite d'un seul noeud, d'apres celles de ses fils
+	static inline void boundNode(KDNode* node)
+	{
+		KDUnroll<Dim>::copy(node->lo,node->data().coords);
+		KDUnroll<Dim>::copy(node->hi,node->data().coords);
+		const KDNode* sons[2]={node->left,node->right};
+		for (int k=0;k<2;k++)
+		{
+			if (sons[k]==NULL) continue;
+			KDUnroll<Dim>::minmax(sons[k]->lo,node->lo,node->hi);
+			KDUnroll<Dim>::minmax(sons[k]->hi,node->lo,node->hi);
+		}
+	}
+	//Distances au carre d'un point au plus proche et au plus loin de la boite d'un sous arbre
+	static inline Dist boxNear(const KDNode* node,const Coord* point)
+	{
+		Dist sum=0;
+		for (short i=0;i<Dim;i++)
+		{
+			Dist d=0;
+			if (point[i]<node->lo[i]) d=static_cast<Dist>(node->lo[i])-static_cast<Dist>(point[i]);
+			else if (point[i]>node->hi[i]) d=static_cast<Dist>(point[i])-static_cast<Dist>(node->hi[i]);
+			sum+=d*d;
+		}
+		return sum;
+	}
+	static inline Dist boxFar(const KDNode* node,const Coord* point)
+	{
+		Dist sum=0;
+		for (short i=0;i<Dim;i++)
+		{
+			Dist a=static_cast<Dist>(point[i])-static_cast<Dist>(node->lo[i]);
+			Dist b=static_cast<Dist>(point[i])-static_cast<Dist>(node->hi[i]);
+			Dist d=(a*a>b*b) ? a : b;
+			sum+=d*d;
+		}
+		return sum;
+	}
 #endif
-	long count(KDNode* start);
 		
 	public:
 			
 	//Constructeurs et Destructeurs
-	KDTree() {root=NULL;}
-	~KDTree() {delete root;}
+	KDTree() {root=NULL;deadRatio=0.25;alpha=0.0;}
+	//Construction equilibree en une passe a partir d'une sequence de KDObject
+	template <class InputIterator> KDTree(InputIterator first, InputIterator last) {root=NULL;deadRatio=0.25;alpha=0.0;build(first,last);}
+	~KDTree() {clear();}
 	
 	//Fonctions de manipulation globales
-	bool insert(const KDObject<Object>& data);
-	//suppr(const KDObject* data);
-	bool minmax(float* min,float* max);
-	KDObjDist<Object> findNN(const float* point);
-	vector< KDObjDist<Object> > findNear(const float* point,const float radius);
-	//findinAABox(const float*& min,const float*& max);
+	bool insert(const KDObj& data);
+	//Insertion en masse : les objets deja presents et les nouveaux sont repartis par medianes
+	template <class InputIterator> bool build(InputIterator first, InputIterator last);
+	bool build(const vector<KDObj>& data) {return build(data.begin(),data.end());}
+	//Meme construction, les sous arbres independants etant repartis sur les threads de pool
+	//L'arbre obtenu est identique a celui de la construction sequentielle
+	template <class InputIterator> bool build(InputIterator first, InputIterator last, KDThreadPool& threads);
+	//Suppression de l'objet obj place en point, ou de tous les objets verifiant pred(const KDObj&)
+	bool remove(const Coord* point,const Object& obj);
+	template <class Predicate> long removeIf(Predicate pred);
+	//Part de noeuds supprimes toleree dans un sous arbre (0.25 par defaut)
+	void setDeadRatio(double ratio) {deadRatio=ratio;}
+	//Insertions auto-equilibrees pour alpha dans ]0.5,1[ (0.7 par exemple) : la profondeur reste
+	//en O(log n), balance() devient inutile ; 0 pour revenir aux insertions simples
+	void setAlpha(double a) {alpha=a;}
+	bool minmax(Coord* min,Coord* max) const;
+	KDRes findNN(const Coord* point) const;
+	//Plus proche voisin approche : a une distance d'au plus (1+epsilon) fois la meilleure
+	//Avec maxVisits>0, au plus maxVisits noeuds sont visites, sans plus aucune garantie
+	KDRes findNN(const Coord* point,const Dist epsilon,size_t maxVisits=0) const;
+	vector<KDRes> findNear(const Coord* point,const Dist radius) const;
+	//Ajoute les resultats a la fin de result et renvoie leur nombre : en reutilisant le meme
+	//tableau d'une requete a l'autre, il n'y a plus d'allocation
+	size_t findNear(const Coord* point,const Dist radius,vector<KDRes>& result) const;
+	//Appelle callback(const KDObj&,Dist) pour chaque objet dans le rayon, avec sa distance
+	//au carre, et le renvoie (comme for_each) ; aucune allocation
+	template <class Callback> Callback forEachNear(const Coord* point,const Dist radius,Callback callback) const
+	{
+		if (root!=NULL) findNear(root,0,point,radius,callback);
+		return callback;
+	}
+	//Nombre d'objets dans le rayon, sans les recopier (avec BBOX, par sous arbres entiers)
+	long countNear(const Coord* point,const Dist radius) const;
+	//k plus proches voisins dans un rayon maximal, tries par distance croissante
+	//Avec epsilon et maxVisits, recherche approchee comme pour findNN
+	vector<KDRes> findKNN(const Coord* point,size_t k,const Dist maxRadius=numeric_limits<Dist>::max(),const Dist epsilon=0,size_t maxVisits=0) const;
+	//Requetes groupees, reparties sur les threads de pool
+	//points contient les nb points a chercher a la suite (nb*Dim coordonnees)
+	//reorder : les requetes sont traitees le long d'une courbe de Morton, les requetes voisines
+	//parcourent alors les memes noeuds ; les resultats restent dans l'ordre des requetes.
+	//Utile pour les grands groupes de requetes dispersees.
+	void findNearBatch(const Coord* points,size_t nb,const Dist radius,KDBatch& result,KDThreadPool& pool,bool reorder=false) const;
+	void findNNBatch(const Coord* points,size_t nb,vector<KDRes>& result,KDThreadPool& pool,bool reorder=false) const;
+	//Recherche dans une boite alignee sur les axes, bornes comprises
+	vector<Object> findInAABox(const Coord* min,const Coord* max) const;
+	//Avec BBOX, les sous arbres entierement dans (ou hors de) la boite sont comptes sans y descendre
+	long countInAABox(const Coord* min,const Coord* max) const;
+	//Appelle callback(const KDObj&) pour chaque objet de la boite, et le renvoie (comme for_each)
+	template <class Callback> Callback forEachInAABox(const Coord* min,const Coord* max,Callback callback) const
+	{
+		if (root!=NULL) findInAABox(root,0,min,max,callback);
+		return callback;
+	}
+	//Sauve la version figee de l'arbre, a relire avec KDFrozenTree::mapFile (inclure KDFrozenTree.hh)
+	bool save(const char* path,size_t bucket=16) const;
 	bool balance(void);
-	long count(void);
-	void stats(void);
+	long count(void) const;
+	void stats(void) const;
+#ifdef KDSTATS
+	//Compteurs de la derniere recherche (apres une recherche groupee parallele : ceux de l'une
+	//quelconque de ses requetes), et cumules depuis la creation de l'arbre ou le dernier resetQueryStats
+	KDQueryStats lastQueryStats(void) const {return last.get();}
+	KDQueryStats queryStats(void) const {return totals;}
+	void resetQueryStats(void) {totals=KDQueryStats();last.set(KDQueryStats());}
+#endif
+	//Vide l'arbre, sans recursion
+	void clear(void);
 	
 };
 
@@ -0,0 +1,394 @@
+/*This is a benchmark program for the KDTree implementation :
+latency percentiles and throughput of each operation, on several datasets and sizes,
+printed as a table and optionally written as CSV or JSON to track regressions*/
+
+#include "KDTree.hh"
+#include "KDFrozenTree.hh"
+#include "KDSharedTree.hh"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <time.h>
+#include <sys/time.h>
+#ifndef __MINGW32__
+#include <sys/resource.h>
+#endif
+using namespace std;
+
+//Objects stored in the trees : the index of the point in its dataset
+class Sample
+{
+public:
+	static const Sample ERROR;
+	long id;
+	Sample(long i=-1) : id(i) {}
+	bool operator == (const Sample& s) const { return id==s.id; }
+};
+const Sample Sample::ERROR;
+
+typedef KDTree<Sample> Tree;
+typedef Tree::KDObj Point;
+typedef KDFrozenTree<Sample> Frozen;
+
+#ifdef  __MINGW32__
+#define srandom srand
+#define random rand
+#endif
+
+//Monotonic clock with nanosecond resolution when available
+double now()
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec+ts.tv_nsec*1e-9;
+#else
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec+tv.tv_usec*1e-6;
+#endif
+}
+
+#define SIDE 1000.0 //points in [ -SIDE/2 , SIDE/2 ]^3
+#define QUERIES 10000 //default number of queries per dataset
+#define RUNS 5 //runs of the one shot operations (build, balance, teardown)
+#define PUBLISHED 1000 //modifications per published version of the shared tree
+#define NEIGHBOURS 16 //the findNear radius gives about this number of results
+#define LOAD 2000000 //default number of points of the raw file loaded into a frozen tree file
+#define PI 3.14159265358979323846
+
+//Uniform random number in [0,1)
+double uniform()
+{
+	return random()/(RAND_MAX+1.0);
+}
+//Normal random number (Box-Muller)
+double gaussian()
+{
+	double u=uniform();
+	while (u<=0.0) u=uniform();
+	return sqrt(-2.0*log(u))*cos(2.0*PI*uniform());
+}
+
+//Peak resident memory of the process so far, in MB (0 when unknown)
+double peakRSS()
+{
+#ifndef __MINGW32__
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF,&usage)==0) return usage.ru_maxrss/1024.0;
+#endif
+	return 0.0;
+}
+
+//Datasets
+const char* datasets[]={"uniform","clustered","plane","line","duplicates","sorted"};
+const int nbdatasets=sizeof(datasets)/sizeof(datasets[0]);
+
+void coords(int kind,float* c)
+{
+	for (int d=0;d<3;d++) c[d]=static_cast<float>((uniform()-0.5)*SIDE);
+	switch (kind)
+	{
+		case 2 : //plane z=0
+			c[2]=0.0f;
+			break;
+		case 3 : //line x=y=z
+			c[1]=c[0];c[2]=c[0];
+			break;
+	}
+}
+
+bool lessX(const Point* a,const Point* b)
+{
+	return a->coords[0]<b->coords[0];
+}
+
+void makeDataset(int kind,size_t n,vector<Point>& points)
+{
+	points.clear();
+	points.reserve(n);
+	//Cluster centers
+	float centers[32][3];
+	for (int k=0;k<32;k++) coords(0,centers[k]);
+	//Distinct points of the duplicates dataset
+	vector<Point> distinct;
+	for (size_t i=0;i<n;i++)
+	{
+		float c[3];
+		if (kind==1)
+		{
+			//32 gaussian clusters
+			const float* center=centers[random()%32];
+			for (int d=0;d<3;d++) c[d]=static_cast<float>(center[d]+gaussian()*SIDE/100.0);
+		}
+		else if (kind==4 && distinct.size()>=n/100+1)
+		{
+			//Each point is one of n/100 distinct ones
+			const Point& p=distinct[random()%distinct.size()];
+			for (int d=0;d<3;d++) c[d]=p.coords[d];
+		}
+		else coords(kind,c);
+		points.push_back(Point(Sample(i),c));
+		if (kind==4 && distinct.size()<n/100+1) distinct.push_back(points.back());
+	}
+	//Sorted arrival along x, like a sweeping sensor
+	if (kind==5)
+	{
+		vector<const Point*> order;
+		for (size_t i=0;i<n;i++) order.push_back(&points[i]);
+		sort(order.begin(),order.end(),lessX);
+		vector<Point> sorted;
+		sorted.reserve(n);
+		for (size_t i=0;i<n;i++) sorted.push_back(Point(Sample(i),order[i]->coords));
+		points.swap(sorted);
+	}
+}
+
+//Measured durations of one operation
+struct Measure
+{
+	string dataset;
+	size_t size;
+	string op;
+	vector<double> times;
+	double total;
+};
+
+double percentile(const vector<double>& sorted,double p)
+{
+	size_t i=static_cast<size_t>(p*sorted.size());
+	return sorted[min(i,sorted.size()-1)];
+}
+
+void report(vector<Measure>& measures,const string& dataset,size_t size,const string& op,vector<double>& times)
+{
+	Measure m;
+	m.dataset=dataset;
+	m.size=size;
+	m.op=op;
+	m.total=0.0;
+	for (size_t i=0;i<times.size();i++) m.total+=times[i];
+	sort(times.begin(),times.end());
+	m.times.swap(times);
+	measures.push_back(m);
+	const vector<double>& t=measures.back().times;
+	cout << dataset << "\t" << size << "\t" << op << "\t" << t.size() << "\t" << t.size()/m.total << "\t"
+		<< percentile(t,0.5)*1e6 << "\t" << percentile(t,0.99)*1e6 << "\t" << percentile(t,0.999)*1e6 << endl;
+}
+
+void usage(const char* name)
+{
+	cerr << "Usage : " << name << " [-n size]... [-q queries] [-l load size] [-csv file] [-json file]" << endl;
+	exit(1);
+}
+
+int main (int argc, char** argv)
+{
+	vector<size_t> sizes;
+	size_t nbqueries=QUERIES;
+	size_t nbload=LOAD;
+	const char* csv=NULL;
+	const char* json=NULL;
+	for (int i=1;i<argc;i++)
+	{
+		if (i+1==argc) usage(argv[0]);
+		if (strcmp(argv[i],"-n")==0) sizes.push_back(atol(argv[++i]));
+		else if (strcmp(argv[i],"-q")==0) nbqueries=atol(argv[++i]);
+		else if (strcmp(argv[i],"-l")==0) nbload=atol(argv[++i]);
+		else if (strcmp(argv[i],"-csv")==0) csv=argv[++i];
+		else if (strcmp(argv[i],"-json")==0) json=argv[++i];
+		else usage(argv[0]);
+	}
+	if (sizes.empty())
+	{
+		sizes.push_back(10000);
+		sizes.push_back(100000);
+	}
+	srandom(time(NULL));
+
+	//Loading a raw point file (xyz floats then the object) into a frozen tree file, first streamed
+	//with an eighth of the points in memory, then all in memory. The peak memory only grows, so
+	//the streamed load runs first : the difference between the two peaks is the memory saved.
+	if (nbload>0)
+	{
+		const char* raw="bench-points.bin";
+		const char* frozen="bench-frozen.kdt";
+		{
+			ofstream out(raw,ios::out | ios::binary | ios::trunc);
+			for (size_t i=0;i<nbload;i++)
+			{
+				float c[3];
+				coords(0,c);
+				const Sample obj(i);
+				out.write(reinterpret_cast<const char*>(c),sizeof(c));
+				out.write(reinterpret_cast<const char*>(&obj),sizeof(obj));
+			}
+		}
+		const double before=peakRSS();
+		cout << "load\tsize\tmethod\tpoints/s\tpeak RSS (MB)" << endl;
+		const size_t budget=nbload*sizeof(Point)/8;
+		double begin=now();
+		bool ok=Frozen::buildFile(raw,frozen,budget);
+		double elapsed=now()-begin;
+		const double streamed=peakRSS();
+		cout << "uniform\t" << nbload << "\tstreamed\t" << nbload/elapsed << "\t" << streamed << endl;
+		//The budget covers the points and their copies, the split nodes (2 leaves of 8 points or more
+		//per 16 points) come on top, with 1 MB for the stream buffers and the allocator
+		const double nodes=(2.0*nbload/16+2)*(1+sizeof(float)+sizeof(size_t));
+		if (peakRSS()>0 && streamed-before>(budget+nodes)/(1024*1024)+1)
+		{
+			cerr << "Streamed load used " << streamed-before << " MB, over its budget of " << budget/(1024.0*1024) << " MB" << endl;
+			ok=false;
+		}
+		begin=now();
+		{
+			vector<Point> points;
+			points.reserve(nbload);
+			ifstream in(raw,ios::in | ios::binary);
+			float c[3];
+			Sample obj;
+			while (in.read(reinterpret_cast<char*>(c),sizeof(c)) && in.read(reinterpret_cast<char*>(&obj),sizeof(obj)))
+				points.push_back(Point(obj,c));
+			Tree tree(points.begin(),points.end());
+			ok=ok && Frozen(tree).save(frozen);
+		}
+		elapsed=now()-begin;
+		cout << "uniform\t" << nbload << "\tin memory\t" << nbload/elapsed << "\t" << peakRSS() << endl;
+		cout << "(peak RSS before loading : " << before << " MB)" << endl << endl;
+		remove(raw);
+		remove(frozen);
+		if (!ok) {cerr << "Unable to load " << raw << " into " << frozen << endl; return 1;}
+	}
+	
+	vector<Measure> measures;
+	cout << "dataset\tsize\toperation\tcount\tops/s\tp50 (us)\tp99 (us)\tp999 (us)" << endl;
+	for (unsigned int s=0;s<sizes.size();s++)
+	{
+		for (int kind=0;kind<nbdatasets;kind++)
+		{
+			const size_t n=sizes[s];
+			const string name=datasets[kind];
+			vector<Point> points;
+			makeDataset(kind,n,points);
+			vector<double> times;
+			double begin;
+
+			//Bulk build and teardown, a few runs
+			for (int r=0;r<RUNS;r++)
+			{
+				begin=now();
+				Tree* t=new Tree(points.begin(),points.end());
+				times.push_back(now()-begin);
+				delete t;
+			}
+			report(measures,name,n,"build",times);
+			for (int r=0;r<RUNS;r++)
+			{
+				Tree* t=new Tree(points.begin(),points.end());
+				begin=now();
+				delete t;
+				times.push_back(now()-begin);
+			}
+			report(measures,name,n,"teardown",times);
+
+			//Inserts one by one, self-balancing (plain inserts degenerate into chains on sorted arrivals)
+			Tree tree;
+			tree.setAlpha(0.7);
+			for (size_t i=0;i<n;i++)
+			{
+				begin=now();
+				tree.insert(points[i]);
+				times.push_back(now()-begin);
+			}
+			report(measures,name,n,"insert",times);
+			for (int r=0;r<RUNS;r++)
+			{
+				begin=now();
+				tree.balance();
+				times.push_back(now()-begin);
+			}
+			report(measures,name,n,"balance",times);
+			
+			//Versions of the shared tree, published after a batch of inserts :
+			//each one is a full rebuild, its cost grows with the tree, not with the batch
+			{
+				KDSharedTree<Sample> shared;
+				const size_t batch=min(static_cast<size_t>(PUBLISHED),n/(2*RUNS)+1);
+				size_t i=0;
+				for (;i+RUNS*batch<n;i++) shared.insert(points[i]);
+				shared.publish();
+				for (int r=0;r<RUNS;r++)
+				{
+					for (size_t k=0;k<batch && i<n;k++) shared.insert(points[i++]);
+					begin=now();
+					shared.publish();
+					times.push_back(now()-begin);
+				}
+				report(measures,name,n,"publish",times);
+			}
+
+			//Queries around the points of the dataset
+			vector<float> queries(3*nbqueries);
+			for (size_t i=0;i<nbqueries;i++)
+			{
+				const Point& p=points[random()%n];
+				for (int d=0;d<3;d++) queries[3*i+d]=static_cast<float>(p.coords[d]+(uniform()-0.5)*SIDE/1000.0);
+			}
+			for (size_t i=0;i<nbqueries;i++)
+			{
+				begin=now();
+				tree.findNN(&queries[3*i]);
+				times.push_back(now()-begin);
+			}
+			report(measures,name,n,"findNN",times);
+			//Radius of about NEIGHBOURS results, from the first queries
+			float radius=0.0f;
+			size_t sample=min(nbqueries,static_cast<size_t>(100));
+			for (size_t i=0;i<sample;i++) radius+=tree.findKNN(&queries[3*i],NEIGHBOURS).back().dist/sample;
+			vector<Tree::KDRes> buffer;
+			for (size_t i=0;i<nbqueries;i++)
+			{
+				buffer.clear();
+				begin=now();
+				tree.findNear(&queries[3*i],radius,buffer);
+				times.push_back(now()-begin);
+			}
+			report(measures,name,n,"findNear",times);
+		}
+	}
+
+	//Machine readable results, times in seconds
+	if (csv!=NULL)
+	{
+		ofstream out(csv);
+		out << "dataset,size,operation,count,total,throughput,p50,p99,p999" << endl;
+		for (size_t i=0;i<measures.size();i++)
+		{
+			const Measure& m=measures[i];
+			out << m.dataset << ',' << m.size << ',' << m.op << ',' << m.times.size() << ',' << m.total << ',' << m.times.size()/m.total << ','
+				<< percentile(m.times,0.5) << ',' << percentile(m.times,0.99) << ',' << percentile(m.times,0.999) << endl;
+		}
+		if (out.fail()) {cerr << "Unable to write " << csv << endl; return 1;}
+	}
+	if (json!=NULL)
+	{
+		ofstream out(json);
+		out << "[" << endl;
+		for (size_t i=0;i<measures.size();i++)
+		{
+			const Measure& m=measures[i];
+			out << "  {\"dataset\": \"" << m.dataset << "\", \"size\": " << m.size << ", \"operation\": \"" << m.op << "\", \"count\": " << m.times.size()
+				<< ", \"total\": " << m.total << ", \"throughput\": " << m.times.size()/m.total << ", \"p50\": " << percentile(m.times,0.5)
+				<< ", \"p99\": " << percentile(m.times,0.99) << ", \"p999\": " << percentile(m.times,0.999) << "}" << (i+1<measures.size() ? "," : "") << endl;
+		}
+		out << "]" << endl;
+		if (out.fail()) {cerr << "Unable to write " << json << endl; return 1;}
+	}
+	return 0;
+}
@@ -1,6 +1,9 @@
 /*This is a test/benchmark program for the KDTree implementation*/
 
 #include "KDTree.hh"
+#include "KDFrozenTree.hh"
+#include "KDSharedTree.hh"
+#include "KDForest.hh"
 #include <math.h>
 
 //Sanity checks
@@ -30,7 +33,7 @@ public:
 	float x,y,z;//Not needed, already in KDObject, just for testing purpose
 	Voxel (float a=0, float b=0, float c=0) : x(a), y(b), z(c) {}
 	
-	bool operator == (const Voxel& v)
+	bool operator == (const Voxel& v) const
 	{
 		return ((v.x == x) && (v.y == y) && (v.z == z));
 	}	
@@ -45,6 +48,7 @@ public:
 		return in; //needed for chaining
 	}
 };
+const Voxel Voxel::ERROR;
 
 
 // Test program
@@ -59,14 +63,61 @@ public:
 #include <time.h>
 time_t begin;
 time_t end;
+//time() is too coarse to compare the building methods
+clock_t cbegin;
+clock_t cend;
+#define CPUSEC(b,e) (static_cast<double>((e)-(b))/CLOCKS_PER_SEC)
+//and clock() adds the time of all threads
+#include <sys/time.h>
+#include <sched.h>
+double walltime()
+{
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec+tv.tv_usec*1e-6;
+}
 
 #define MAX 500000 //maximum number of voxels
 #define MAXQ 1000//(64*48)//max number of requests
 #define MAXC 1000.0f //rem coordinates -> coord [ -MAXC/2 , MAXC/2 ]
 #define RAYON 10.0f//search RAYON
+#define KNN 10//number of neighbours for k nearest neighbours queries
+#define MAXB 100000//number of queries in a batch
+#ifdef CHECK
+#define MAXSWEEP MAXB //largest batch in the batch size sweep
+#else
+#define MAXSWEEP (1<<20)
+#endif
+#define SHAREDN 100000 //voxels inserted in the shared tree
+#define SHAREDBATCH 10000 //inserts per published version
+#define WINDOW (MAX/10) //sliding window of the forest, in inserts
+#define BOXX 100.0f //half sizes of the boxes for box queries (slabs)
+#define BOXY 100.0f
+#define BOXZ 5.0f
 
+//Each check program has its own files, they may run at the same time
+#ifdef BBOX
+#define FILENAME_LIST_RES "list-bbox.res"
+#define FILENAME_TREE_RES "tree-bbox.res"
+#define FILENAME_FROZEN "frozen-bbox.kdt"
+#define FILENAME_POINTS "points-bbox.bin"
+#define FILENAME_STREAMED "streamed-bbox.kdt"
+#define FILENAME_QUANTIZED "quantized-bbox.kdt"
+#else
 #define FILENAME_LIST_RES "list.res"
 #define FILENAME_TREE_RES "tree.res"
+#ifdef CHECK
+#define FILENAME_FROZEN "frozen-check.kdt"
+#define FILENAME_POINTS "points-check.bin"
+#define FILENAME_STREAMED "streamed-check.kdt"
+#define FILENAME_QUANTIZED "quantized-check.kdt"
+#else
+#define FILENAME_FROZEN "frozen-perf.kdt"
+#define FILENAME_POINTS "points-perf.bin"
+#define FILENAME_STREAMED "streamed-perf.kdt"
+#define FILENAME_QUANTIZED "quantized-perf.kdt"
+#endif
+#endif
 
 #define SIZECOORDSUP 3*(1+ 1+ static_cast<int> (logf((MAXC/2.f)/logf(10.f))))
 #define SIZEFLOAT 7
@@ -77,6 +128,137 @@ float distance(const float* coords, const Voxel& v)
 	return sqrtf((coords[0]-v.x) * (coords[0]-v.x) + (coords[1]-v.y)* (coords[1]-v.y) + (coords[2]-v.z) * (coords[2]-v.z));
 }
 
+bool closerResult(const KDObjDist<Voxel>& a, const KDObjDist<Voxel>& b)
+{
+	return a.dist < b.dist;
+}
+
+//k nearest neighbours the old way : findNear with a radius doubled until enough voxels are found
+vector<KDObjDist<Voxel> > findKNNByRadius(KDTree<Voxel>& t, const float* coords, unsigned int k)
+{
+	float radius=RAYON;
+	vector<KDObjDist<Voxel> > res=t.findNear(coords,radius);
+	while (res.size()<k && radius<MAXC*2)
+	{
+		radius*=2;
+		res=t.findNear(coords,radius);
+	}
+	sort(res.begin(),res.end(),closerResult);
+	if (res.size()>k) res.resize(k);
+	return res;
+}
+
+//Callback for box queries
+class VoxelCounter
+{
+public:
+	long nb;
+	VoxelCounter() : nb(0) {}
+	void operator () (const KDObject<Voxel>&) { nb++; }
+};
+
+//Callback for radius queries
+class NearCounter
+{
+public:
+	long nb;
+	NearCounter() : nb(0) {}
+	void operator () (const KDObject<Voxel>&, float) { nb++; }
+};
+
+//Box query the old way : findNear with the radius of the circumscribed sphere, then filtering
+vector<Voxel> findInAABoxByRadius(const KDTree<Voxel>& t, const float* min, const float* max)
+{
+	float center[3],radius=0.0f;
+	for (int d=0;d<3;d++)
+	{
+		center[d]=(min[d]+max[d])/2.0f;
+		radius+=(max[d]-min[d])*(max[d]-min[d])/4.0f;
+	}
+	vector<KDObjDist<Voxel> > res=t.findNear(center,sqrtf(radius));
+	vector<Voxel> inbox;
+	for (unsigned int k=0;k<res.size();k++)
+	{
+		const Voxel& v=res[k].object;
+		if (min[0]<=v.x && v.x<=max[0] && min[1]<=v.y && v.y<=max[1] && min[2]<=v.z && v.z<=max[2]) inbox.push_back(v);
+	}
+	return inbox;
+}
+
+//Reader thread of the shared tree : queries the last published version until told to stop
+struct SharedReader
+{
+	KDSharedTree<Voxel>* shared;
+	const vector<float>* queries;
+	volatile bool* stop;
+	long done;
+	bool ok;
+	pthread_t thread;
+};
+//Takes a reader slot of the shared tree from another thread, and keeps it
+struct SharedAttach
+{
+	KDSharedTree<Voxel>* shared;
+	int slot;
+};
+void* attachShared(void* arg)
+{
+	SharedAttach* a=static_cast<SharedAttach*>(arg);
+	a->slot=a->shared->attach();
+	return NULL;
+}
+
+void* readShared(void* arg)
+{
+	SharedReader* r=static_cast<SharedReader*>(arg);
+	int slot=r->shared->attach();
+	if (slot<0)
+	{
+		r->ok=false;
+		return NULL;
+	}
+	long last=0;
+	size_t nbq=r->queries->size()/3;
+	for (size_t i=0;!*r->stop;i=(i+1)%nbq)
+	{
+		const float* q=&(*r->queries)[i*3];
+		KDSharedTree<Voxel>::Snapshot snap(*r->shared,slot);
+		//Published versions only grow, by whole batches
+		long nb=snap.tree().count();
+		if (nb<last || nb%SHAREDBATCH!=0) r->ok=false;
+		last=nb;
+		KDObjDist<Voxel> nn=snap.tree().findNN(q);
+		if (nb>0 && fabs(nn.dist-distance(q,nn.object))>1e-3) r->ok=false;
+		r->done++;
+	}
+	r->shared->detach(slot);
+	return NULL;
+}
+
+//Sort by first coordinate, to insert objects in sorted order
+template <class KDObj> bool firstCoordLess(const KDObj* a, const KDObj* b)
+{
+	return a->coords[0]<b->coords[0];
+}
+
+//Counts the iterations run by a parallelFor, yielding to let other workers steal meanwhile
+class IterationCounter : public KDThreadPool::Body
+{
+public:
+	volatile long done;
+	IterationCounter() : done(0) {}
+	void operator () (size_t first,size_t last,int) { sched_yield(); __sync_fetch_and_add(&done,static_cast<long>(last-first)); }
+};
+
+//Predicate for removeIf : voxels whose x is below a limit
+class VoxelBelow
+{
+	float limit;
+public:
+	VoxelBelow(float l) : limit(l) {}
+	template <class KDObj> bool operator () (const KDObj& o) const { return o.obj.x<limit; }
+};
+
 void printpercent(int curPct,const int i)
 {
 	if (curPct<(i*100)/MAXQ)
@@ -87,8 +269,109 @@ void printpercent(int curPct,const int i)
 	}
 }
 
+#ifdef CHECK
+//Checks a KDTree instance with other dimensions and coordinates types against a brute force search
+template <int Dim, class Coord> bool checkInstance(int nb, int nbq, Coord maxc, Coord radius)
+{
+	typedef KDTree<Voxel,Dim,Coord> Tree;
+	typedef typename Tree::Dist Dist;
+	vector<typename Tree::KDObj> objs;
+	for (int i=0;i<nb;i++)
+	{
+		typename Tree::KDObj obj(Voxel(i,0,0));
+		for (int d=0;d<Dim;d++) obj[d]=static_cast<Coord>(remainderf(random(), maxc));
+		objs.push_back(obj);
+	}
+	//Half inserted one by one, half in one pass
+	Tree t;
+	for (int i=0;i<nb/2;i++) t.insert(objs[i]);
+	t.build(objs.begin()+nb/2,objs.end());
+	if (t.count()!=nb) return false;
+	Coord q[Dim];
+	for (int i=0;i<nbq;i++)
+	{
+		for (int d=0;d<Dim;d++) q[d]=static_cast<Coord>(remainderf(random(), maxc));
+		size_t found=0;
+		for (int k=0;k<nb;k++) if (objs[k].dist(q)<=static_cast<Dist>(radius)) found++;
+		if (t.findNear(q,radius).size()!=found) return false;
+	}
+	//Self-balancing inserts in sorted order must give the same results
+	vector<const typename Tree::KDObj*> sorted;
+	for (int i=0;i<nb;i++) sorted.push_back(&objs[i]);
+	sort(sorted.begin(),sorted.end(),firstCoordLess<typename Tree::KDObj>);
+	Tree ts;
+	ts.setAlpha(0.7);
+	for (int i=0;i<nb;i++) ts.insert(*sorted[i]);
+	for (int i=0;i<nbq;i++)
+	{
+		for (int d=0;d<Dim;d++) q[d]=static_cast<Coord>(remainderf(random(), maxc));
+		if (ts.findNear(q,radius).size()!=t.findNear(q,radius).size()) return false;
+	}
+	//Removing one voxel out of three one by one, then the first quarter at once
+	for (int i=0;i<nb;i+=3) if (!t.remove(objs[i].coords,objs[i].obj)) return false;
+	if (t.remove(objs[0].coords,objs[0].obj)) return false;
+	long removed=t.removeIf(VoxelBelow(nb/4));
+	if (removed!=nb/4-(nb/4+2)/3 || t.count()!=nb-(nb+2)/3-removed) return false;
+	for (int i=0;i<nbq;i++)
+	{
+		for (int d=0;d<Dim;d++) q[d]=static_cast<Coord>(remainderf(random(), maxc));
+		size_t found=0;
+		Dist best=numeric_limits<Dist>::max();
+		for (int k=nb/4;k<nb;k++)
+		{
+			if (k%3==0) continue;
+			if (objs[k].dist(q)<=static_cast<Dist>(radius)) found++;
+			best=min(best,objs[k].dist(q));
+		}
+		if (t.findNear(q,radius).size()!=found || t.countNear(q,radius)!=static_cast<long>(found) || t.findNN(q).dist!=best) return false;
+	}
+	//Bounding box of the remaining objects, through a const tree
+	const Tree& ct=t;
+	Coord lo[Dim],hi[Dim],blo[Dim],bhi[Dim];
+	for (int d=0;d<Dim;d++) {blo[d]=numeric_limits<Coord>::max();bhi[d]=-numeric_limits<Coord>::max();}
+	for (int k=nb/4;k<nb;k++)
+		if (k%3!=0) for (int d=0;d<Dim;d++) {blo[d]=min(blo[d],objs[k][d]);bhi[d]=max(bhi[d],objs[k][d]);}
+	if (!ct.minmax(lo,hi) || ct.count()!=t.count()) return false;
+	for (int d=0;d<Dim;d++) if (lo[d]!=blo[d] || hi[d]!=bhi[d]) return false;
+	//Removing the only extreme object must shrink the bounding box
+	Tree te(objs.begin(),objs.begin()+1000);
+	typename Tree::KDObj far(Voxel(-1,0,0));
+	for (int d=0;d<Dim;d++) far[d]=static_cast<Coord>(maxc*5);
+	te.insert(far);
+	if (!te.remove(far.coords,far.obj) || !te.minmax(lo,hi)) return false;
+	for (int d=0;d<Dim;d++) {blo[d]=numeric_limits<Coord>::max();bhi[d]=-numeric_limits<Coord>::max();}
+	for (int k=0;k<1000;k++)
+		for (int d=0;d<Dim;d++) {blo[d]=min(blo[d],objs[k][d]);bhi[d]=max(bhi[d],objs[k][d]);}
+	for (int d=0;d<Dim;d++) if (lo[d]!=blo[d] || hi[d]!=bhi[d]) return false;
+	return true;
+}
+#endif
+
 int main (int argc, char** argv)
 {
+#ifdef CHECK
+	cout << "Checking other KDTree instances...";flush(cout);
+	if (!checkInstance<2,double>(10000,200,100.0,5.0) || !checkInstance<6,int>(10000,200,20,8))
+	{
+		cerr << "ERROR : KDTree instance with other dimensions or coordinates gave wrong results" << endl;
+		exit(1);
+	}
+	//parallelFor must not return before every iteration has run
+	{
+		KDThreadPool pool(8);
+		for (int r=0;r<200;r++)
+		{
+			IterationCounter counter;
+			pool.parallelFor(0,1024,1,counter);
+			if (counter.done!=1024)
+			{
+				cerr << "ERROR : parallelFor returned before all its iterations ran" << endl;
+				exit(1);
+			}
+		}
+	}
+	cout << "Done" << endl;
+#endif
 	cout << endl << "This is a test program for the KDTree Imlementation." << endl;
 	
 	const string grabbed="Grabbed";
@@ -119,16 +402,25 @@ int main (int argc, char** argv)
 	cout << "Done" << endl;
 	cout<<"Computing Time spend = "<<difftime(end,begin)<< " seconds"<<endl;
 	
+	vector< KDObject<Voxel> > objs;
+	for( int i = 0; i < MAX; i++ )
+	{
+		KDObject<Voxel> obj(list[i]);
+		obj[0]=list[i].x;obj[1]=list[i].y;obj[2]=list[i].z;
+		objs.push_back(obj);
+	}
+	
     cout << "Inserting " << MAX<< " Voxels in a KDTree...";flush(cout);
     begin=time(NULL);
+	cbegin=clock();
 	for( int i = 0; i < MAX; i++ )
 	{
 		//cout << "Inserting " << v <<endl;
-		KDObject<Voxel> obj(list[i]);
-		obj[0]=list[i].x;obj[1]=list[i].y;obj[2]=list[i].z;
-		t.insert( obj );
+		t.insert( objs[i] );
     }
+	cend=clock();
 	end=time(NULL);
+	double insertTime=CPUSEC(cbegin,cend);
 	cout << "Done" << endl;
 	cout<<"Computing Time spend = "<<difftime(end,begin)<< " seconds"<<endl;
 	
@@ -141,7 +433,10 @@ int main (int argc, char** argv)
 
 	//Optimizing the KDTree for research (theorically not exactly balanced)
 	cout << endl << "Balancing...";flush(cout);
+	cbegin=clock();
 	t.balance();
+	cend=clock();
+	double balanceTime=CPUSEC(cbegin,cend);
 	cout << "Done" << endl;
 
 	//Displaying stats about the KDTree
@@ -152,6 +447,165 @@ int main (int argc, char** argv)
 	cout<<"Computing Time spend = "<<difftime(end,begin)<< " seconds"<<endl;
 
 	
+	//Building the same KDTree in one pass, with median splits
+	cout << endl << "Bulk building a KDTree of " << MAX << " Voxels...";flush(cout);
+	cbegin=clock();
+	KDTree<Voxel>* ptb=new KDTree<Voxel>(objs.begin(),objs.end());
+	KDTree<Voxel>& tb=*ptb;
+	cend=clock();
+	double buildTime=CPUSEC(cbegin,cend);
+	cout << "Done" << endl;
+	cout << "KDTree statistics : " << endl;
+	tb.stats();
+	cout << "CPU Time : Insert = " << insertTime << " s + Balance = " << balanceTime << " s , Bulk build = " << buildTime << " s" << endl;
+	
+	//Parallel bulk build, on 1 to 8 threads (or more if there are more processors)
+	int maxthreads=max(8,KDThreadPool().size());
+	for (int nbthreads=1;nbthreads<=maxthreads;nbthreads*=2)
+	{
+		KDThreadPool threads(nbthreads);
+		KDTree<Voxel> tp;
+		double wbegin=walltime();
+		tp.build(objs.begin(),objs.end(),threads);
+		cout << "Time for a parallel bulk build on " << nbthreads << " threads = " << walltime()-wbegin << " s" << endl;
+#ifdef CHECK
+		//Same tree : same results in the same order
+		for (int i=0;i<MAXQ;i++)
+		{
+			const float q[3]={remainderf(random(), MAXC),remainderf(random(), MAXC),remainderf(random(), MAXC)};
+			const vector<KDObjDist<Voxel> > rp=tp.findNear(q,RAYON);
+			const vector<KDObjDist<Voxel> > rb=tb.findNear(q,RAYON);
+			bool same=(rp.size()==rb.size());
+			for (unsigned int k=0;k<rp.size() && same;k++) same=(rp[k].object==rb[k].object);
+			if (!same)
+			{
+				cerr << "ERROR : Parallel build differs from the sequential one" << endl;
+				exit(1);
+			}
+		}
+#endif
+	}
+	
+	//Self-balancing inserts, in random order then sorted along x like a sensor sweep
+	vector<const KDObject<Voxel>*> stream;
+	for (int i=0;i<MAX;i++) stream.push_back(&objs[i]);
+	for (int s=0;s<2;s++)
+	{
+		if (s==1) sort(stream.begin(),stream.end(),firstCoordLess< KDObject<Voxel> >);
+		cout << endl << "Inserting " << MAX << (s==0 ? " random" : " sorted") << " Voxels in a self-balancing KDTree...";flush(cout);
+		KDTree<Voxel> ta;
+		ta.setAlpha(0.7);
+		cbegin=clock();
+		for (int i=0;i<MAX;i++) ta.insert(*stream[i]);
+		cend=clock();
+		cout << "Done" << endl;
+		ta.stats();
+		cout << "CPU Time : Self-balancing insert = " << CPUSEC(cbegin,cend) << " s" << endl;
+#ifdef CHECK
+		for (int i=0;i<MAXQ;i++)
+		{
+			const float q[3]={remainderf(random(), MAXC),remainderf(random(), MAXC),remainderf(random(), MAXC)};
+			if (ta.findNear(q,RAYON).size()!=tb.findNear(q,RAYON).size() || ta.findNN(q).dist!=tb.findNN(q).dist)
+			{
+				cerr << "ERROR : Self-balancing KDTree results differ from the built KDTree ones" << endl;
+				exit(1);
+			}
+		}
+#endif
+	}
+	
+	//Freezing it in a flat array
+	cout << endl << "Freezing the KDTree...";flush(cout);
+	cbegin=clock();
+	const KDFrozenTree<Voxel> tf(tb);
+	cend=clock();
+	cout << "Done" << endl;
+	cout << "Frozen KDTree statistics : " << endl;
+	tf.stats();
+	cout << "CPU Time : Freeze = " << CPUSEC(cbegin,cend) << " s" << endl;
+	
+	//Saving it, then mapping the file instead of building again
+	cout << endl << "Saving the frozen KDTree and mapping it back...";flush(cout);
+	cbegin=clock();
+	bool saved=tf.save(FILENAME_FROZEN);
+	cend=clock();
+	double saveTime=CPUSEC(cbegin,cend);
+	KDFrozenTree<Voxel> tm;
+	double wbegin=walltime();
+	bool loaded=saved && tm.mapFile(FILENAME_FROZEN);
+	double mapTime=walltime()-wbegin;
+	if (!loaded)
+	{
+		cerr << "ERROR : Cannot save or map " << FILENAME_FROZEN << endl;
+		exit(1);
+	}
+	cout << "Done" << endl;
+	tm.stats();
+	cout << "Time : Save = " << saveTime << " s , Map = " << mapTime << " s" << endl;
+#ifdef CHECK
+	//Files of another kind of tree are rejected, copies live in memory
+	KDFrozenTree<Voxel,2,double> wrong;
+	const KDFrozenTree<Voxel> tc(tm);
+	KDFrozenTree<Voxel> ts;
+	if (wrong.mapFile(FILENAME_FROZEN) || tm.mapFile("missing.kdt") || !tm.mapped() || tc.mapped() || tc.count()!=tb.count()
+		|| !tb.save(FILENAME_FROZEN) || !ts.mapFile(FILENAME_FROZEN) || ts.count()!=tb.count())
+	{
+		cerr << "ERROR : Mapping the saved frozen KDTree gave a wrong tree" << endl;
+		exit(1);
+	}
+#endif
+	
+	//Building the frozen KDTree file straight from a raw point file, a tenth of it in memory at a time
+	cout << endl << "Streaming a raw point file into a frozen KDTree file...";flush(cout);
+	{
+		ofstream raw(FILENAME_POINTS,ios::out | ios::binary | ios::trunc);
+		for (int i=0;i<MAX;i++)
+		{
+			raw.write(reinterpret_cast<const char*>(objs[i].coords),3*sizeof(float));
+			raw.write(reinterpret_cast<const char*>(&objs[i].obj),sizeof(Voxel));
+		}
+	}
+	wbegin=walltime();
+	bool streamed=KDFrozenTree<Voxel>::buildFile(FILENAME_POINTS,FILENAME_STREAMED,MAX*(sizeof(KDObject<Voxel>)+sizeof(void*))/10);
+	double streamTime=walltime()-wbegin;
+	KDFrozenTree<Voxel> tl;
+	if (!streamed || !tl.mapFile(FILENAME_STREAMED) || tl.count()!=MAX)
+	{
+		cerr << "ERROR : Cannot build or map the streamed frozen KDTree " << FILENAME_STREAMED << endl;
+		exit(1);
+	}
+#if defined(CHECK) && !defined(__MINGW32__)
+	//A part that cannot be written (its temporary file is taken by a directory) fails the build,
+	//without leaving any temporary file behind
+	{
+		const string failed=string(FILENAME_POINTS)+".kdt";
+		mkdir((failed+".1").c_str(),0700);
+		bool built=KDFrozenTree<Voxel>::buildFile(FILENAME_POINTS,failed.c_str(),MAX*(sizeof(KDObject<Voxel>)+sizeof(void*))/10);
+		rmdir((failed+".1").c_str());
+		remove(failed.c_str());
+		if (built || access((failed+".2").c_str(),F_OK)==0 || access((failed+".3").c_str(),F_OK)==0)
+		{
+			cerr << "ERROR : A failed streamed build left temporary files behind" << endl;
+			exit(1);
+		}
+	}
+#endif
+	remove(FILENAME_POINTS);
+	cout << "Done" << endl;
+	cout << "Time : Streamed build = " << streamTime << " s" << endl;
+#ifdef CHECK
+	//Same splits as the frozen KDTree built in memory
+	for (int i=0;i<MAXQ;i++)
+	{
+		const float q[3]={remainderf(random(), MAXC),remainderf(random(), MAXC),remainderf(random(), MAXC)};
+		if (tl.findNear(q,RAYON).size()!=tf.findNear(q,RAYON).size() || tl.findNN(q).dist!=tf.findNN(q).dist)
+		{
+			cerr << "ERROR : Streamed frozen KDTree results differ from the frozen KDTree ones" << endl;
+			exit(1);
+		}
+	}
+#endif
+	
 	cout << "Preparing the test..." << endl;
 	vector <float*> testlist;
 	float* coord;
@@ -166,7 +620,6 @@ int main (int argc, char** argv)
 	cout << "Done." << endl;
 		
 	//Queriing MAXQ times
-	float tmp=0.0;
 	int curPct;
 	
 #ifdef CHECK	
@@ -179,6 +632,7 @@ int main (int argc, char** argv)
 	reslist.open(FILENAME_LIST_RES, ios::out | ios::trunc);
 	if (!reslist.is_open()){ cerr << "Unable to open the list results file"<<endl; exit(1);}
 	float lsum=0.0;
+	vector<float> lnearest;
 	curPct=-1;
 	for (int i=0;i<MAXQ;i++)
 	{
@@ -188,9 +642,11 @@ int main (int argc, char** argv)
 		int ind=lresult.size();
 		//Search in list
 		int lfound=0;
-		begin=time(NULL);
+		double qbegin=walltime();
+		float nearest=distance(testlist.at(i),list[0]);
 		for ( unsigned int k=0;k<list.size();k++)
 		{
+			if (distance(testlist.at(i),list[k])<nearest) nearest=distance(testlist.at(i),list[k]);
 			if (distance(testlist.at(i),list[k])<=RAYON)
 			{
 				lfound++;
@@ -198,10 +654,9 @@ int main (int argc, char** argv)
 				ldists.push_back(distance(testlist.at(i),list[k]));
 			}
 		}
-		end=time(NULL);
-		//We sum the duration to compute a mean later
-		tmp=difftime(end,begin);
-		lsum+=(tmp<0)?0:tmp;
+		//We sum the duration to compute a mean later (time() is too coarse for one query)
+		lsum+=walltime()-qbegin;
+		lnearest.push_back(nearest);
 		for ( int k=ind;k<ind+lfound;k++)
 		{
 			reslist << ' ' << grabbed << ' ' << lresult[k];
@@ -234,7 +689,7 @@ int main (int argc, char** argv)
 		int ind=result.size();
 #endif
 		//Search in the tree
-		begin=time(NULL);
+		double qbegin=walltime();
 		vector<KDObjDist<Voxel> > res=t.findNear(testlist[i],RAYON);
 		int found=res.size();
 		for (int k=0;k<found;k++)
@@ -243,10 +698,31 @@ int main (int argc, char** argv)
 			dists.push_back(res[k].dist);
 			//cout << res[k].object << endl;
 		}
-		end=time(NULL);
-		tmp=difftime(end,begin);
-		sum+=(tmp<0)?0:tmp; //to avoide some negative time measures on short duration
+		sum+=walltime()-qbegin;
 #ifdef CHECK
+		//The bulk built tree must find the same voxels
+		if (tb.findNear(testlist[i],RAYON).size() != res.size())
+		{
+			cerr << "ERROR : Not the same number of results found in built and inserted trees" << endl;
+			exit(1);
+		}
+		//k nearest neighbours must match the radius search ones
+		vector<KDObjDist<Voxel> > knn=tb.findKNN(testlist[i],KNN);
+		vector<KDObjDist<Voxel> > knnref=findKNNByRadius(tb,testlist[i],KNN);
+		bool knnok=(knn.size()==knnref.size()) && (tb.findKNN(testlist[i],1)[0].dist==lnearest[i]) && (tb.findKNN(testlist[i],MAX,RAYON).size()==res.size());
+		for (unsigned int k=0;knnok && k<knn.size();k++) knnok=(knn[k].dist==knnref[k].dist);
+		if (!knnok)
+		{
+			cerr << "ERROR : k nearest neighbours differ from the radius search ones" << endl;
+			exit(1);
+		}
+		//So must the frozen tree
+		if (tf.findNear(testlist[i],RAYON).size() != res.size() || tf.findNN(testlist[i]).dist != lnearest[i]
+			|| tm.findNear(testlist[i],RAYON).size() != res.size() || !(tm.findNN(testlist[i]).object == tf.findNN(testlist[i]).object))
+		{
+			cerr << "ERROR : Frozen tree results differ from the list and tree ones" << endl;
+			exit(1);
+		}
 		for (int k=ind;k<ind+found;k++)
 		{
 			restree << ' ' << grabbed << ' ' << result[k];
@@ -264,6 +740,523 @@ int main (int argc, char** argv)
 	cout << "KDTree Duration : Total = " << sum << " Mean = "<< sum / MAXQ << endl;
 	cout << endl << "Mean number of query results = " << result.size()/MAXQ << endl;
 	
+	//Comparing the pointer and frozen layouts on the same queries
+	cbegin=clock();
+	for (int i=0;i<MAXQ;i++) tb.findNear(testlist[i],RAYON);
+	cend=clock();
+	double treeTime=CPUSEC(cbegin,cend);
+	cbegin=clock();
+	for (int i=0;i<MAXQ;i++) tf.findNear(testlist[i],RAYON);
+	cend=clock();
+	cout << "CPU Time for " << MAXQ << " queries : Built KDTree = " << treeTime << " s , Frozen KDTree = " << CPUSEC(cbegin,cend) << " s" << endl;
+	
+	//Same queries without allocations : reused buffer and callback
+	vector<KDObjDist<Voxel> > buffer;
+	cbegin=clock();
+	for (int i=0;i<MAXQ;i++)
+	{
+		buffer.clear();
+		tb.findNear(testlist[i],RAYON,buffer);
+	}
+	cend=clock();
+	double bufferTime=CPUSEC(cbegin,cend);
+	cbegin=clock();
+	for (int i=0;i<MAXQ;i++) tb.forEachNear(testlist[i],RAYON,NearCounter());
+	cend=clock();
+	double forEachTime=CPUSEC(cbegin,cend);
+	cbegin=clock();
+	for (int i=0;i<MAXQ;i++) tb.countNear(testlist[i],RAYON);
+	cend=clock();
+	cout << "CPU Time for " << MAXQ << " queries : findNear = " << treeTime << " s , findNear in a reused buffer = " << bufferTime << " s , forEachNear = " << forEachTime << " s , countNear = " << CPUSEC(cbegin,cend) << " s" << endl;
+#ifdef CHECK
+	for (int i=0;i<MAXQ;i++)
+	{
+		const vector<KDObjDist<Voxel> > res=tb.findNear(testlist[i],RAYON);
+		buffer.clear();
+		bool same=(tb.findNear(testlist[i],RAYON,buffer)==res.size() && tb.forEachNear(testlist[i],RAYON,NearCounter()).nb==static_cast<long>(res.size())
+			&& tb.countNear(testlist[i],RAYON)==static_cast<long>(res.size()));
+		for (unsigned int k=0;k<res.size() && same;k++) same=(buffer[k].object==res[k].object && buffer[k].dist==res[k].dist);
+		if (!same)
+		{
+			cerr << "ERROR : findNear in a buffer or forEachNear differ from findNear" << endl;
+			exit(1);
+		}
+	}
+#endif
+#ifdef KDSTATS
+	//Query counters : per query, then aggregated over the tree
+	tb.resetQueryStats();
+	size_t statsFound=tb.findNear(testlist[0],RAYON).size();
+	KDQueryStats qs=tb.lastQueryStats();
+	if (qs.queries!=1 || qs.hits!=static_cast<long>(statsFound) || qs.visited<=0 || qs.distances<qs.hits || qs.maxstack<=0 || tb.queryStats().visited!=qs.visited)
+	{
+		cerr << "ERROR : findNear query counters are wrong" << endl;
+		exit(1);
+	}
+	tb.resetQueryStats();
+	for (int i=0;i<MAXQ;i++) tb.findNN(testlist[i]);
+	qs=tb.queryStats();
+	if (qs.queries!=MAXQ || qs.visited<MAXQ || qs.hits<MAXQ)
+	{
+		cerr << "ERROR : findNN query counters are wrong" << endl;
+		exit(1);
+	}
+	cout << "findNN per query : " << static_cast<double>(qs.visited)/qs.queries << " nodes visited , " << static_cast<double>(qs.pruned)/qs.queries << " subtrees pruned , max stack " << qs.maxstack << endl;
+	tb.stats();
+#endif
+	
+	//Comparing the k nearest neighbours search with growing radius searches
+	cbegin=clock();
+	for (int i=0;i<MAXQ;i++) tb.findKNN(testlist[i],KNN);
+	cend=clock();
+	double knnTime=CPUSEC(cbegin,cend);
+	cbegin=clock();
+	for (int i=0;i<MAXQ;i++) findKNNByRadius(tb,testlist[i],KNN);
+	cend=clock();
+	cout << "CPU Time for " << MAXQ << " " << KNN << "-NN queries : findKNN = " << knnTime << " s , findNear with doubling radius = " << CPUSEC(cbegin,cend) << " s" << endl;
+	
+	//Batch queries, shared between threads
+	KDThreadPool pool;
+	vector<float> batch;
+	for (int i=0;i<MAXB*3;i++) batch.push_back(remainderf(random(), MAXC));
+	KDBatchRes<Voxel> batchres;
+	vector<KDObjDist<Voxel> > batchnn;
+	wbegin=walltime();
+	for (int i=0;i<MAXB;i++) tb.findNear(&batch[i*3],RAYON);
+	for (int i=0;i<MAXB;i++) tb.findNN(&batch[i*3]);
+	double serialTime=walltime()-wbegin;
+	wbegin=walltime();
+	tb.findNearBatch(&batch[0],MAXB,RAYON,batchres,pool);
+	tb.findNNBatch(&batch[0],MAXB,batchnn,pool);
+	cout << "Time for " << MAXB << " findNear + findNN queries : one by one = " << serialTime << " s , in batch on " << pool.size() << " threads = " << walltime()-wbegin << " s" << endl;
+#ifdef CHECK
+	for (int i=0;i<MAXB;i++)
+	{
+		KDObjDist<Voxel> nn=tb.findNN(&batch[i*3]);
+		if (batchres.count(i)!=tb.findNear(&batch[i*3],RAYON).size() || !(batchnn[i].object==nn.object) || batchnn[i].dist!=nn.dist)
+		{
+			cerr << "ERROR : Batch query results differ from the single query ones" << endl;
+			exit(1);
+		}
+	}
+	//Queries reordered along a Morton curve, results back in the order of the queries
+	KDBatchRes<Voxel> mortonres;
+	vector<KDObjDist<Voxel> > mortonnn;
+	tb.findNearBatch(&batch[0],MAXB,RAYON,mortonres,pool,true);
+	tb.findNNBatch(&batch[0],MAXB,mortonnn,pool,true);
+	bool sameOrder=(mortonres.offsets==batchres.offsets && mortonres.hits.size()==batchres.hits.size());
+	for (unsigned int i=0;i<batchres.hits.size() && sameOrder;i++) sameOrder=(mortonres.hits[i].object==batchres.hits[i].object);
+	for (int i=0;i<MAXB && sameOrder;i++) sameOrder=(mortonnn[i].object==batchnn[i].object && mortonnn[i].dist==batchnn[i].dist);
+	if (!sameOrder)
+	{
+		cerr << "ERROR : Reordered batch query results differ from the batch ones" << endl;
+		exit(1);
+	}
+#endif
+	
+	//Batch size sweep : random order against Morton order, each size run on at least 65536
+	//different queries (repeating a small batch would keep its nodes in cache)
+	for (int size=64;size<=MAXSWEEP;size=(size*16>MAXSWEEP && size<MAXSWEEP) ? MAXSWEEP : size*16)
+	{
+		const int runs=max(1,65536/size);
+		vector<float> sweep;
+		for (int i=0;i<runs*size*3;i++) sweep.push_back(remainderf(random(), MAXC));
+		double times[2];
+		for (int reorder=0;reorder<2;reorder++)
+		{
+			wbegin=walltime();
+			for (int r=0;r<runs;r++) tb.findNearBatch(&sweep[r*size*3],size,RAYON,batchres,pool,reorder==1);
+			times[reorder]=walltime()-wbegin;
+		}
+		cout << "Batches of " << size << " findNear queries : " << runs*size/times[0] << " queries/s in random order , " << runs*size/times[1]
+			<< " queries/s in Morton order (x" << times[0]/times[1] << ")" << endl;
+	}
+	
+	//One writer inserting and publishing versions while reader threads query the shared tree
+	for (int nbreaders=1;nbreaders<=4;nbreaders*=2)
+	{
+		KDSharedTree<Voxel> shared;
+		volatile bool stop=false;
+		vector<SharedReader> readers(nbreaders);
+		for (int r=0;r<nbreaders;r++)
+		{
+			readers[r].shared=&shared;readers[r].queries=&batch;readers[r].stop=&stop;
+			readers[r].done=0;readers[r].ok=true;
+			pthread_create(&readers[r].thread,NULL,readShared,&readers[r]);
+		}
+		wbegin=walltime();
+		for (int i=0;i<SHAREDN;i++)
+		{
+			KDObject<Voxel> obj(list[i]);
+			obj[0]=list[i].x;obj[1]=list[i].y;obj[2]=list[i].z;
+			shared.insert(obj);
+			if ((i+1)%SHAREDBATCH==0) shared.publish();
+		}
+		double writeTime=walltime()-wbegin;
+		stop=true;
+		long done=0;
+		bool ok=true;
+		for (int r=0;r<nbreaders;r++)
+		{
+			pthread_join(readers[r].thread,NULL);
+			done+=readers[r].done;
+			ok=ok && readers[r].ok;
+		}
+		cout << "Shared tree with " << nbreaders << " reader threads : " << SHAREDN/SHAREDBATCH << " versions published in " << writeTime << " s , " << done/writeTime << " queries/s meanwhile" << endl;
+		if (!ok)
+		{
+			cerr << "ERROR : A reader saw an inconsistent version of the shared tree" << endl;
+			exit(1);
+		}
+#ifdef CHECK
+		//Without readers, every replaced version is freed
+		shared.publish();
+		int slot=shared.attach();
+		if (shared.versions()!=1 || shared.count(slot)!=SHAREDN)
+		{
+			cerr << "ERROR : Shared tree versions are not reclaimed, or its last version is incomplete" << endl;
+			exit(1);
+		}
+		for (int i=0;i<MAXQ;i++)
+		{
+			float nearest=distance(testlist[i],list[0]);
+			size_t found=0;
+			for (int k=0;k<SHAREDN;k++)
+			{
+				nearest=min(nearest,distance(testlist[i],list[k]));
+				if (distance(testlist[i],list[k])<=RAYON) found++;
+			}
+			if (shared.findNear(slot,testlist[i],RAYON).size()!=found || fabs(shared.findNN(slot,testlist[i]).dist-nearest)>1e-3)
+			{
+				cerr << "ERROR : Shared tree results differ from the list ones" << endl;
+				exit(1);
+			}
+		}
+		shared.detach(slot);
+		//Readers beyond the slots only see an empty tree
+		KDSharedTree<Voxel> single(1);
+		single.insert(objs[0]);
+		single.publish();
+		int first=single.attach();
+		int extra=single.attach();
+		{
+			KDSharedTree<Voxel>::Snapshot snap(single,extra);
+			if (first!=0 || extra!=-1 || snap.valid() || snap.tree().count()!=0 || single.count(first)!=1)
+			{
+				cerr << "ERROR : Shared tree readers without a slot are not rejected" << endl;
+				exit(1);
+			}
+		}
+		single.detach(first);
+		//So do slots held by another thread, or released
+		KDSharedTree<Voxel> pair(2);
+		pair.insert(objs[0]);
+		pair.publish();
+		SharedAttach other;
+		other.shared=&pair;
+		pthread_t thread;
+		pthread_create(&thread,NULL,attachShared,&other);
+		pthread_join(thread,NULL);
+		int mine=pair.attach();
+		pair.detach(other.slot);
+		bool rejected=(other.slot==0 && mine==1 && pair.attach()==-1 && pair.count(other.slot)==0 && pair.count(mine)==1);
+		pair.detach(mine);
+		{
+			KDSharedTree<Voxel>::Snapshot held(pair,other.slot);
+			KDSharedTree<Voxel>::Snapshot released(pair,mine);
+			rejected=rejected && !held.valid() && !released.valid();
+		}
+		if (!rejected)
+		{
+			cerr << "ERROR : Shared tree readers on a slot they do not hold are not rejected" << endl;
+			exit(1);
+		}
+#endif
+	}
+	
+	//Forest of frozen trees : buffered inserts, each voxel dated by its insertion rank
+	{
+		KDForest<Voxel> forest;
+		double wbegin=walltime();
+		for (int i=0;i<MAX;i++) forest.insert(objs[i],i);
+		double forestTime=walltime()-wbegin;
+		cout << endl << "Forest of " << forest.trees() << " frozen trees : " << MAX/forestTime << " inserts/s (KDTree : " << MAX/insertTime << " inserts/s)" << endl;
+		forest.stats();
+#ifdef CHECK
+		for (int i=0;i<MAXQ;i++)
+			if (forest.findNear(testlist[i],RAYON).size()!=tb.findNear(testlist[i],RAYON).size() || forest.findNN(testlist[i]).dist!=tb.findNN(testlist[i]).dist)
+			{
+				cerr << "ERROR : Forest results differ from the KDTree ones" << endl;
+				exit(1);
+			}
+		//Only whole trees older than the limit are dropped, the newest voxels are all kept
+		const long limit=MAX-MAX/3;
+		long dropped=forest.expire(limit);
+		KDForest<Voxel> windowed;
+		windowed.setWindow(WINDOW);
+		for (int i=0;i<MAX;i++) windowed.insert(objs[i],i);
+		if (dropped<=0 || forest.count()+dropped!=MAX || forest.count()<MAX-limit || windowed.count()<=WINDOW || windowed.count()>=MAX
+			|| windowed.findNN(objs[MAX-1].coords).dist!=0)
+		{
+			cerr << "ERROR : Forest expiry dropped the wrong trees" << endl;
+			exit(1);
+		}
+		cout << "Forest with a window of " << WINDOW << " inserts : " << windowed.count() << " voxels kept in " << windowed.trees() << " trees" << endl;
+#endif
+	}
+	
+	//Box queries against radius queries of the circumscribed sphere
+	vector<float> boxmin,boxmax;
+	for (int i=0;i<MAXQ;i++)
+	{
+		boxmin.push_back(testlist[i][0]-BOXX);boxmin.push_back(testlist[i][1]-BOXY);boxmin.push_back(testlist[i][2]-BOXZ);
+		boxmax.push_back(testlist[i][0]+BOXX);boxmax.push_back(testlist[i][1]+BOXY);boxmax.push_back(testlist[i][2]+BOXZ);
+	}
+	cbegin=clock();
+	for (int i=0;i<MAXQ;i++) tb.findInAABox(&boxmin[i*3],&boxmax[i*3]);
+	cend=clock();
+	double boxTime=CPUSEC(cbegin,cend);
+	cbegin=clock();
+	for (int i=0;i<MAXQ;i++) tb.countInAABox(&boxmin[i*3],&boxmax[i*3]);
+	cend=clock();
+	double countTime=CPUSEC(cbegin,cend);
+	cbegin=clock();
+	for (int i=0;i<MAXQ;i++) findInAABoxByRadius(tb,&boxmin[i*3],&boxmax[i*3]);
+	cend=clock();
+	cout << "CPU Time for " << MAXQ << " box queries : findInAABox = " << boxTime << " s , countInAABox = " << countTime << " s , findNear and filter = " << CPUSEC(cbegin,cend) << " s" << endl;
+#ifdef CHECK
+	for (int i=0;i<MAXQ;i++)
+	{
+		const float* min=&boxmin[i*3];
+		const float* max=&boxmax[i*3];
+		long inbox=0;
+		for (unsigned int k=0;k<list.size();k++)
+			if (min[0]<=list[k].x && list[k].x<=max[0] && min[1]<=list[k].y && list[k].y<=max[1] && min[2]<=list[k].z && list[k].z<=max[2]) inbox++;
+		if (tb.countInAABox(min,max)!=inbox || static_cast<long>(tb.findInAABox(min,max).size())!=inbox || tb.forEachInAABox(min,max,VoxelCounter()).nb!=inbox
+			|| static_cast<long>(findInAABoxByRadius(tb,min,max).size())!=inbox)
+		{
+			cerr << "ERROR : Box query results differ from the list ones" << endl;
+			exit(1);
+		}
+	}
+#endif
+	
+	//Approximate nearest neighbours : recall and speedup against the exact searches
+	vector<KDObjDist<Voxel> > exact(MAXB);
+	vector<vector<KDObjDist<Voxel> > > exactknn(MAXQ);
+	cbegin=clock();
+	for (int i=0;i<MAXB;i++) exact[i]=tb.findNN(&batch[i*3]);
+	cend=clock();
+	double exactTime=CPUSEC(cbegin,cend);
+	cbegin=clock();
+	for (int i=0;i<MAXQ;i++) exactknn[i]=tb.findKNN(&batch[i*3],KNN);
+	cend=clock();
+	double exactKNNTime=CPUSEC(cbegin,cend);
+	const float epsilons[]={0.1f,0.5f,1.0f,2.0f};
+	const size_t budgets[]={0,0,0,0,16,64};
+	for (unsigned int e=0;e<sizeof(budgets)/sizeof(budgets[0]);e++)
+	{
+		const float eps=(e<4) ? epsilons[e] : 0.0f;
+		long found=0;
+		cbegin=clock();
+		for (int i=0;i<MAXB;i++) if (tb.findNN(&batch[i*3],eps,budgets[e]).dist==exact[i].dist) found++;
+		cend=clock();
+		double approxTime=CPUSEC(cbegin,cend);
+		long foundknn=0;
+		cbegin=clock();
+		for (int i=0;i<MAXQ;i++)
+		{
+			const vector<KDObjDist<Voxel> > knn=tb.findKNN(&batch[i*3],KNN,numeric_limits<float>::max(),eps,budgets[e]);
+			for (unsigned int k=0;k<knn.size();k++) if (knn[k].dist<=exactknn[i].back().dist) foundknn++;
+		}
+		cend=clock();
+		cout << "Approximate search with epsilon = " << eps << " , at most " << budgets[e] << " visits (0 : no limit) : ";
+		cout << "findNN speedup = " << exactTime/approxTime << " , recall = " << 100.0*found/MAXB << " % ; ";
+		cout << "findKNN speedup = " << exactKNNTime/CPUSEC(cbegin,cend) << " , recall = " << 100.0*foundknn/(MAXQ*KNN) << " %" << endl;
+#ifdef CHECK
+		//Without a budget, the result is at most (1+epsilon) times farther
+		for (int i=0;i<MAXQ && budgets[e]==0;i++)
+		{
+			const KDObjDist<Voxel> nn=tb.findNN(&batch[i*3],eps);
+			const vector<KDObjDist<Voxel> > knn=tb.findKNN(&batch[i*3],KNN,numeric_limits<float>::max(),eps);
+			if (nn.dist>(1+eps)*exact[i].dist*1.0001f || knn.size()!=KNN || knn.back().dist>(1+eps)*exactknn[i].back().dist*1.0001f)
+			{
+				cerr << "ERROR : Approximate search beyond its (1+epsilon) bound" << endl;
+				exit(1);
+			}
+		}
+#endif
+	}
+	
+	//Sweeping the size of the frozen KDTree leaves
+	const size_t buckets[]={1,2,4,8,16,32,64};
+	for (unsigned int b=0;b<sizeof(buckets)/sizeof(buckets[0]);b++)
+	{
+		const KDFrozenTree<Voxel> tfb(tb,buckets[b]);
+		cbegin=clock();
+		for (int i=0;i<MAXB;i++) tfb.findNear(&batch[i*3],RAYON);
+		cend=clock();
+		double nearTime=CPUSEC(cbegin,cend);
+		cbegin=clock();
+		for (int i=0;i<MAXB;i++) tfb.findNN(&batch[i*3]);
+		cend=clock();
+		cout << "Frozen KDTree with leaves of " << buckets[b] << " points : CPU Time for " << MAXB << " queries : findNear = " << nearTime << " s , findNN = " << CPUSEC(cbegin,cend) << " s" << endl;
+#ifdef CHECK
+		for (int i=0;i<MAXQ;i++)
+		{
+			if (tfb.findNear(testlist[i],RAYON).size() != tb.findNear(testlist[i],RAYON).size() || tfb.findNN(testlist[i]).dist != lnearest[i])
+			{
+				cerr << "ERROR : Frozen tree results differ from the list and tree ones with leaves of " << buckets[b] << " points" << endl;
+				exit(1);
+			}
+		}
+#endif
+	}
+	
+	//Leaves scanned on 16 bits coordinates, exact distances for the candidates only
+	KDFrozenTree<Voxel> tq(tf);
+	wbegin=walltime();
+	tq.quantize();
+	cout << "Quantizing the frozen KDTree coordinates : " << walltime()-wbegin << " s" << endl;
+	tq.stats();
+	//The quantized coordinates are saved with the tree, and mapped back with it
+	KDFrozenTree<Voxel> tqm;
+	if (!tq.save(FILENAME_QUANTIZED) || !tqm.mapFile(FILENAME_QUANTIZED) || !tqm.quantized())
+	{
+		cerr << "ERROR : Cannot save or map the quantized frozen KDTree " << FILENAME_QUANTIZED << endl;
+		exit(1);
+	}
+	double qtimes[2];
+	for (int q=0;q<2;q++)
+	{
+		const KDFrozenTree<Voxel>& tt=(q==0) ? tf : tq;
+		cbegin=clock();
+		for (int i=0;i<MAXB;i++) tt.findNear(&batch[i*3],RAYON);
+		for (int i=0;i<MAXB;i++) tt.findNN(&batch[i*3]);
+		cend=clock();
+		qtimes[q]=CPUSEC(cbegin,cend);
+	}
+	cout << "CPU Time for " << MAXB << " findNear + findNN queries : Frozen KDTree = " << qtimes[0] << " s , with quantized leaves = " << qtimes[1] << " s" << endl;
+#ifdef CHECK
+	for (int i=0;i<MAXB;i++)
+	{
+		const vector<KDObjDist<Voxel> > exactNear=tf.findNear(&batch[i*3],RAYON);
+		const vector<KDObjDist<Voxel> > quantNear=tq.findNear(&batch[i*3],RAYON);
+		const vector<KDObjDist<Voxel> > mappedNear=tqm.findNear(&batch[i*3],RAYON);
+		bool same=(exactNear.size()==quantNear.size() && exactNear.size()==mappedNear.size()
+			&& tq.findNN(&batch[i*3]).dist==tf.findNN(&batch[i*3]).dist && tqm.findNN(&batch[i*3]).dist==tf.findNN(&batch[i*3]).dist);
+		for (unsigned int k=0;k<exactNear.size() && same;k++)
+			same=(exactNear[k].object==quantNear[k].object && exactNear[k].dist==quantNear[k].dist
+				&& exactNear[k].object==mappedNear[k].object && exactNear[k].dist==mappedNear[k].dist);
+		if (!same)
+		{
+			cerr << "ERROR : Quantized frozen tree results differ from the exact ones" << endl;
+			exit(1);
+		}
+	}
+#endif
+	
+	//All the pairs of voxels within RAYON : one findNear per voxel against a dual-tree traversal
+	wbegin=walltime();
+	size_t naive=0;
+	for (unsigned int i=0;i<list.size();i++)
+	{
+		const float c[3]={list[i].x,list[i].y,list[i].z};
+		naive+=tf.findNear(c,RAYON).size()-1;
+	}
+	double naiveTime=walltime()-wbegin;
+	wbegin=walltime();
+	const vector<KDPairDist<Voxel> > pairs=tf.pairsWithin(RAYON);
+	double joinTime=walltime()-wbegin;
+	wbegin=walltime();
+	const vector<KDPairDist<Voxel> > ppairs=tf.pairsWithin(RAYON,pool);
+	cout << "Time for the " << pairs.size() << " pairs within " << RAYON << " : findNear per voxel = " << naiveTime << " s , pairsWithin = " << joinTime
+		<< " s , pairsWithin on " << pool.size() << " threads = " << walltime()-wbegin << " s" << endl;
+#ifdef CHECK
+	//Each pair once, against both neighbours finding each other ; between two trees, each voxel also finds itself
+	const KDFrozenTree<Voxel> tf4(tb,4);
+	bool joined=(2*pairs.size()==naive && ppairs.size()==pairs.size() && tf.pairsWithin(tf4,RAYON).size()==naive+list.size());
+	for (unsigned int i=0;i<pairs.size() && joined;i++)
+	{
+		const float c[3]={pairs[i].first.x,pairs[i].first.y,pairs[i].first.z};
+		joined=(pairs[i].dist<=RAYON && fabs(distance(c,pairs[i].second)-pairs[i].dist)<1e-3);
+	}
+	if (!joined)
+	{
+		cerr << "ERROR : pairsWithin results differ from the findNear ones" << endl;
+		exit(1);
+	}
+#endif
+	
+	//k nearest neighbours graph of all the voxels, against a findKNN loop (on the first MAXB voxels)
+	wbegin=walltime();
+	for (int i=0;i<MAXB;i++)
+	{
+		const float c[3]={tf.coord(i,0),tf.coord(i,1),tf.coord(i,2)};
+		tb.findKNN(c,KNN+1);
+	}
+	double knnLoopTime=(walltime()-wbegin)/MAXB;
+	KDKNNGraph<> graph,pgraph;
+	wbegin=walltime();
+	tf.buildKNNGraph(KNN,graph);
+	double graphTime=(walltime()-wbegin)/tf.count();
+	wbegin=walltime();
+	tf.buildKNNGraph(KNN,pgraph,pool);
+	cout << KNN << "-NN graph of " << tf.count() << " voxels , time per voxel : findKNN loop = " << knnLoopTime*1e6 << " us , buildKNNGraph = " << graphTime*1e6
+		<< " us , buildKNNGraph on " << pool.size() << " threads = " << (walltime()-wbegin)/tf.count()*1e6 << " us" << endl;
+#ifdef CHECK
+	//Same distances as findKNN, without the voxel itself (a duplicate voxel stays, at distance 0)
+	bool sameGraph=(graph.k==KNN && graph.size()==static_cast<size_t>(tf.count()) && pgraph.neighbors==graph.neighbors && pgraph.dists==graph.dists);
+	for (int i=0;i<MAXQ && sameGraph;i++)
+	{
+		const size_t p=(static_cast<size_t>(i)*7919)%graph.size();
+		const float c[3]={tf.coord(p,0),tf.coord(p,1),tf.coord(p,2)};
+		const vector<KDObjDist<Voxel> > knn=tb.findKNN(c,KNN+1);
+		for (int r=0;r<KNN && sameGraph;r++)
+		{
+			const float n[3]={tf.coord(graph.of(p)[r],0),tf.coord(graph.of(p)[r],1),tf.coord(graph.of(p)[r],2)};
+			sameGraph=(graph.of(p)[r]!=p && fabs(graph.dists[p*KNN+r]-knn[r+1].dist)<1e-3 && fabs(distance(n,tf.object(p))-graph.dists[p*KNN+r])<1e-3);
+		}
+	}
+	if (!sameGraph)
+	{
+		cerr << "ERROR : buildKNNGraph results differ from the findKNN ones" << endl;
+		exit(1);
+	}
+#endif
+	
+	//Removing voxels from the inserted KDTree
+	cout << endl << "Removing " << MAXB << " Voxels one by one, then all the Voxels with x < 0...";flush(cout);
+	cbegin=clock();
+	for (int i=0;i<MAXB;i++) t.remove(objs[i].coords,objs[i].obj);
+	cend=clock();
+	double removeTime=CPUSEC(cbegin,cend);
+	cbegin=clock();
+	long removed=t.removeIf(VoxelBelow(0.0f));
+	cend=clock();
+	cout << "Done (" << removed << " Voxels with x < 0)" << endl;
+	t.stats();
+	cout << "CPU Time : remove = " << removeTime << " s , removeIf = " << CPUSEC(cbegin,cend) << " s" << endl;
+#ifdef CHECK
+	long below=0;
+	for (int i=MAXB;i<MAX;i++) if (list[i].x<0.0f) below++;
+	if (removed!=below || t.count()!=MAX-MAXB-below)
+	{
+		cerr << "ERROR : Wrong number of Voxels removed" << endl;
+		exit(1);
+	}
+	for (int i=0;i<MAXQ;i++)
+	{
+		size_t found=0;
+		for (int k=MAXB;k<MAX;k++) if (list[k].x>=0.0f && objs[k].dist(testlist[i])<=RAYON) found++;
+		if (t.findNear(testlist[i],RAYON).size()!=found || t.countNear(testlist[i],RAYON)!=static_cast<long>(found))
+		{
+			cerr << "ERROR : Removed Voxels are still found" << endl;
+			exit(1);
+		}
+	}
+#endif
+	
 #ifdef CHECK
 	//We need to compare the results
 	cout << "You can now compare the results in the .res file..." << endl;
@@ -301,6 +1294,7 @@ int main (int argc, char** argv)
 		/*UGLY*/
 		reslist >> tmpl >> voxtmpl ; //cout << tmpl << endl;
 		restree >> tmpt >> voxtmpt ; //cout << tmpt <<endl;
+		if (reslist.fail() && restree.fail()) break; //both files ended
 		if ((tmpl == wanted) && (tmpt == wanted))
 		{
 			//If this is the end of a grabbed list, we must compare results
@@ -369,8 +1363,19 @@ int main (int argc, char** argv)
 #endif	
 	
 		
+	remove(FILENAME_FROZEN);
+	remove(FILENAME_STREAMED);
+	remove(FILENAME_QUANTIZED);
 	cout << "End : Freeing Memory..." << endl;
-	//KDTree is deleted at the end, because it is a variable in this main function.
+	cbegin=clock();
+	t.clear();
+	cend=clock();
+	double clearTime=CPUSEC(cbegin,cend);
+	cbegin=clock();
+	delete ptb;
+	cend=clock();
+	cout << "CPU Time : Teardown = " << clearTime << " s (inserted KDTree) , " << CPUSEC(cbegin,cend) << " s (built KDTree)" << endl;
+	//The first KDTree is deleted at the end, because it is a variable in this main function.
 	//Just check the memory to see if the delete function is working well ;)
     return 0;
 }